@@ -0,0 +1,322 @@
+/**
+ * Parallel program to multiply matrices with algorithm-based fault tolerance (ABFT)
+ *
+ * The packing stage appends to every T-row block of A a column-checksum row (the sum of its
+ * rows) and to every T-column block of B a row-checksum column (the sum of its columns). The
+ * kernel multiplies the augmented blocks, so each C tile comes out with the column sums and row
+ * sums it should have. As soon as a tile is finished its actual sums are compared with those
+ * checksums, and a tile that disagrees (a flipped bit in a register, cache or the stored tile)
+ * is recomputed on its own rather than the whole multiply being rerun.
+ *
+ * A second checksum pair of absolute values gives the scale of the tile's rounding error, so
+ * the tolerance follows the data.
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_abft.cpp -o optimized_parallel_abft
+ *  (run): ./optimized_parallel_abft <matrix_size> [faults_to_inject]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <stdint.h>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define T 64                //side of a C tile
+#define TA (T + 2)          //rows of a packed A block: T rows, their sum, the sum of their absolute values
+#define TB (T + 4)          //columns of a packed B block: T columns, their sum, the sum of their absolute values, 2 zero
+#define TOLERANCE 16        //allowed checksum error, in units of sqrt(size) * DBL_EPSILON * (mean |A| * |B| column sum of the tile)
+#define MAX_ATTEMPTS 3
+
+/*A fault to inject: flip bit of element (row, col) of tile (ti, tj) after its first computation*/
+struct Fault {
+  int ti, tj, row, col, bit;
+};
+
+/*What the ABFT multiply saw*/
+struct AbftStats {
+  long tiles, recomputed, unrecovered;
+};
+
+
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(-8,8);
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*
+ * A method to pack A into row blocks of TA rows: rows bi*T .. bi*T+T-1 (zero past size), then
+ * their sum, then the sum of their absolute values. Block bi starts at packed + bi * TA * size.
+ */
+void packA(double** matA, double* packed, int size){
+  int blocks = (size + T - 1) / T;
+  #pragma omp parallel for
+  for (int bi = 0; bi < blocks; bi++) {
+    double* block = packed + (long)bi * TA * size;
+    double* sum = block + (long)T * size;
+    double* abs = sum + size;
+    memset(block, 0, (long)TA * size * sizeof(double));
+    for (int r = 0; r < T && bi * T + r < size; r++) {
+      const double* a = matA[bi * T + r];
+      memcpy(block + (long)r * size, a, size * sizeof(double));
+      for (int k = 0; k < size; k++) {
+        sum[k] += a[k];
+        abs[k] += fabs(a[k]);
+      }
+    }
+  }
+}
+
+/*
+ * A method to pack B into column blocks of TB columns, each as TB/4 panels of 4 columns stored
+ * k by k: columns bj*T .. bj*T+T-1 (zero past size), then a panel holding their sum, the sum of
+ * their absolute values and two zeros. Block bj starts at packed + bj * TB * size.
+ */
+void packB(double** matB, double* packed, int size){
+  int blocks = (size + T - 1) / T;
+  #pragma omp parallel for
+  for (int bj = 0; bj < blocks; bj++) {
+    double* block = packed + (long)bj * TB * size;
+    for (int k = 0; k < size; k++) {
+      double sum = 0, abs = 0;
+      for (int c = 0; c < T; c++) {
+        int j = bj * T + c;
+        double b = j < size ? matB[k][j] : 0;
+        block[((long)(c / 4) * size + k) * 4 + c % 4] = b;
+        sum += b;
+        abs += fabs(b);
+      }
+      double* check = block + ((long)(T / 4) * size + k) * 4;
+      check[0] = sum; check[1] = abs; check[2] = 0; check[3] = 0;
+    }
+  }
+}
+
+/*A method to compute the augmented TA x TB tile: every packed row of the A block times every panel of the B block*/
+void tileKernel(const double* aBlock, const double* bBlock, double* tile, int size){
+  for (int r = 0; r < TA; r++) {
+    const double* ar = aBlock + (long)r * size;
+    for (int p = 0; p < TB / 4; p++) {
+      const double* bp = bBlock + (long)p * size * 4;
+      __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+      int k = 0;
+      for (; k + 2 <= size; k += 2) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ar[k]), _mm256_loadu_pd(&bp[k * 4])));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_set1_pd(ar[k+1]), _mm256_loadu_pd(&bp[k * 4 + 4])));
+      }
+      if (k < size) acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ar[k]), _mm256_loadu_pd(&bp[k * 4])));
+      _mm256_storeu_pd(&tile[r * TB + p * 4], _mm256_add_pd(acc0, acc1));
+    }
+  }
+}
+
+/*
+ * A method to check a stored C tile against the checksums of its augmented tile: each column
+ * sum against row T, each row sum against column T. The absolute checksums meet at (T+1, T+1),
+ * the sum over the tile of |A| * |B|; the tolerance is proportional to its mean per column.
+ */
+bool checkTile(double** matC, const double* tile, int i0, int j0, int rows, int cols, int size){
+  double scale = tile[(T + 1) * TB + T + 1] / T;
+  double bound = TOLERANCE * sqrt((double)size) * DBL_EPSILON * scale + DBL_MIN;
+  for (int c = 0; c < cols; c++) {
+    double sum = 0;
+    for (int r = 0; r < rows; r++) sum += matC[i0 + r][j0 + c];
+    if (!(fabs(sum - tile[T * TB + c]) <= bound)) return false;    //also catches NaN
+  }
+  for (int r = 0; r < rows; r++) {
+    double sum = 0;
+    for (int c = 0; c < cols; c++) sum += matC[i0 + r][j0 + c];
+    if (!(fabs(sum - tile[r * TB + T]) <= bound)) return false;
+  }
+  return true;
+}
+
+/*A method to flip one bit of a double*/
+void flipBit(double& x, int bit){
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits ^= 1ULL << bit;
+  memcpy(&x, &bits, sizeof(bits));
+}
+
+/*
+ * A method to perform C = A * B with ABFT. Tiles are computed in parallel; each is checked as
+ * soon as it is stored and recomputed, up to MAX_ATTEMPTS times in all, while its checksums
+ * disagree. faults are injected after the first computation of their tiles to exercise this.
+ */
+AbftStats abft_mat_multiply(double** matA, double** matB, double** matC, int size, const vector<Fault>& faults){
+  int blocks = (size + T - 1) / T;
+  double* packedA = (double*)_mm_malloc((long)blocks * TA * size * sizeof(double), 32);
+  double* packedB = (double*)_mm_malloc((long)blocks * TB * size * sizeof(double), 32);
+  packA(matA, packedA, size);
+  packB(matB, packedB, size);
+  long recomputed = 0, unrecovered = 0;
+
+  #pragma omp parallel
+  {
+    vector<double> tile(TA * TB);
+    #pragma omp for collapse(2) schedule(dynamic) reduction(+:recomputed, unrecovered)
+    for (int ti = 0; ti < blocks; ti++) {
+      for (int tj = 0; tj < blocks; tj++) {
+        int i0 = ti * T, j0 = tj * T;
+        int rows = min(T, size - i0), cols = min(T, size - j0);
+        bool ok = false;
+        for (int attempt = 0; attempt < MAX_ATTEMPTS && !ok; attempt++) {
+          if (attempt > 0) recomputed++;
+          tileKernel(packedA + (long)ti * TA * size, packedB + (long)tj * TB * size, &tile[0], size);
+          for (int r = 0; r < rows; r++)
+            for (int c = 0; c < cols; c++) matC[i0 + r][j0 + c] = tile[r * TB + c];
+          if (attempt == 0) {
+            for (size_t f = 0; f < faults.size(); f++)
+              if (faults[f].ti == ti && faults[f].tj == tj) flipBit(matC[i0 + faults[f].row][j0 + faults[f].col], faults[f].bit);
+          }
+          ok = checkTile(matC, &tile[0], i0, j0, rows, cols, size);
+        }
+        if (!ok) unrecovered++;
+      }
+    }
+  }
+
+  _mm_free(packedA);
+  _mm_free(packedB);
+  AbftStats stats = {(long)blocks * blocks, recomputed, unrecovered};
+  return stats;
+}
+
+/*The same multiply without checksums, as the baseline and the reference*/
+void mat_multiply(double** matA, double** matB, double** matC, int size){
+  int blocks = (size + T - 1) / T;
+  double* packedA = (double*)_mm_malloc((long)blocks * TA * size * sizeof(double), 32);
+  double* packedB = (double*)_mm_malloc((long)blocks * TB * size * sizeof(double), 32);
+  packA(matA, packedA, size);
+  packB(matB, packedB, size);
+
+  #pragma omp parallel for collapse(2) schedule(dynamic)
+  for (int ti = 0; ti < blocks; ti++) {
+    for (int tj = 0; tj < blocks; tj++) {
+      const double* aBlock = packedA + (long)ti * TA * size;
+      const double* bBlock = packedB + (long)tj * TB * size;
+      for (int r = 0; r < T && ti * T + r < size; r++) {
+        const double* ar = aBlock + (long)r * size;
+        for (int p = 0; p < T / 4; p++) {
+          const double* bp = bBlock + (long)p * size * 4;
+          __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+          int k = 0;
+          for (; k + 2 <= size; k += 2) {
+            acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ar[k]), _mm256_loadu_pd(&bp[k * 4])));
+            acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_set1_pd(ar[k+1]), _mm256_loadu_pd(&bp[k * 4 + 4])));
+          }
+          if (k < size) acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ar[k]), _mm256_loadu_pd(&bp[k * 4])));
+          double out[4];
+          _mm256_storeu_pd(out, _mm256_add_pd(acc0, acc1));
+          for (int c = 0; c < 4 && tj * T + 4 * p + c < size; c++) matC[ti * T + r][tj * T + 4 * p + c] = out[c];
+        }
+      }
+    }
+  }
+
+  _mm_free(packedA);
+  _mm_free(packedB);
+}
+
+/*A method that multiplies with and without ABFT, injecting faults into the ABFT run, and compares the results*/
+void matAbft(int size, int faultCount){
+  double** matA = initMat(size);
+  double** matB = initMat(size);
+  double** matC = initMat(size);
+  double** ref = initMat(size);
+  populateMat(matA, size);
+  populateMat(matB, size);
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  mat_multiply(matA, matB, ref, size);
+  double plainMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  start = high_resolution_clock::now();
+  AbftStats clean = abft_mat_multiply(matA, matB, matC, size, vector<Fault>());
+  double abftMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  cout<<"plain multiply: "<<plainMs<<"ms"<<endl;
+  cout<<"ABFT multiply:  "<<abftMs<<"ms ("<<100 * (abftMs - plainMs) / plainMs<<"% overhead), "
+      <<clean.tiles<<" tiles, "<<clean.recomputed<<" recomputed"<<endl;
+
+  //faults in distinct tiles: one bit each, from the low mantissa up to the exponent
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  int blocks = (size + T - 1) / T;
+  vector<Fault> faults;
+  vector<bool> used((long)blocks * blocks, false);
+  for (int f = 0; f < faultCount && f < blocks * blocks; f++) {
+    Fault fault;
+    do { fault.ti = gen() % blocks; fault.tj = gen() % blocks; } while (used[(long)fault.ti * blocks + fault.tj]);
+    used[(long)fault.ti * blocks + fault.tj] = true;
+    fault.row = gen() % min(T, size - fault.ti * T);
+    fault.col = gen() % min(T, size - fault.tj * T);
+    fault.bit = faultCount > 1 ? 10 + f * 53 / (faultCount - 1) : 62;
+    if (fault.bit > 62) fault.bit = 62;
+    faults.push_back(fault);
+  }
+  AbftStats faulty = abft_mat_multiply(matA, matB, matC, size, faults);
+
+  double maxDiff = 0;
+  for (int i = 0; i < size; i++)
+    for (int j = 0; j < size; j++) maxDiff = max(maxDiff, fabs(ref[i][j] - matC[i][j]) / max(1.0, fabs(ref[i][j])));
+  cout<<faults.size()<<" bit flips injected (bits "<<(faults.empty() ? 0 : faults.front().bit)<<" to "
+      <<(faults.empty() ? 0 : faults.back().bit)<<"): "<<faulty.recomputed<<" tiles recomputed, "
+      <<faulty.unrecovered<<" unrecovered"<<endl;
+  cout<<"max relative difference from the plain multiply = "<<maxDiff
+      <<" (flips in the lowest mantissa bits are within rounding and are left alone)"<<endl;
+
+  freeMat(matA, size);
+  freeMat(matB, size);
+  freeMat(matC, size);
+  freeMat(ref, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [faults_to_inject]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  int faults = argc > 2 ? atoi(argv[2]) : 8;
+  if (size < 1 || faults < 0) {
+    cout<<"the matrix size must be positive and the number of faults not negative"<<endl;
+    return 1;
+  }
+  matAbft(size, faults);
+  return 0;
+}
@@ -0,0 +1,256 @@
+/**
+ * Parallel program with an asynchronous multiply service: submit(A, B) returns a future for
+ * C = A * B straight away, and a persistent two-stage pipeline packs the B of the next job
+ * while the current job is being multiplied
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp -pthread optimized_parallel_async.cpp -o optimized_parallel_async
+ *  (run): ./optimized_parallel_async <matrix_size> <jobs> [client_threads]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <stdexcept>
+#include <cmath>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define QUEUE_DEPTH 4     //jobs that may wait between two stages
+
+/*A row-major rows x cols matrix*/
+struct Matrix {
+  int rows, cols;
+  vector<double> data;
+
+  Matrix() : rows(0), cols(0) {}
+  Matrix(int r, int c) : rows(r), cols(c), data((long)r * c) {}
+};
+
+/*One multiply on its way through the pipeline*/
+struct Job {
+  Matrix a, b;
+  vector<double> packedB;
+  promise<Matrix> result;
+};
+
+/*
+ * A blocking queue of at most capacity jobs. push() waits while it is full, so submitters that
+ * run far ahead of the engine are held back instead of queueing unbounded memory.
+ */
+struct JobQueue {
+  deque<Job*> items;
+  size_t capacity;
+  mutex lock;
+  condition_variable notFull, notEmpty;
+
+  explicit JobQueue(size_t c) : capacity(c) {}
+
+  void push(Job* job){
+    unique_lock<mutex> guard(lock);
+    notFull.wait(guard, [this] { return items.size() < capacity; });
+    items.push_back(job);
+    notEmpty.notify_one();
+  }
+
+  Job* pop(){
+    unique_lock<mutex> guard(lock);
+    notEmpty.wait(guard, [this] { return !items.empty(); });
+    Job* job = items.front();
+    items.pop_front();
+    notFull.notify_one();
+    return job;
+  }
+};
+
+
+/*A method to populate a matrix with random numbers*/
+void populateMat(Matrix& matrix, unsigned seed){
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+  for (double& v : matrix.data) v = dis(gen);
+}
+
+/*
+ * A method to pack B into column panels of 4: panel g holds B[k][4g..4g+3] for every k,
+ * contiguously, so the kernel reads B with unit stride. The last panel is zero padded.
+ */
+void packB(const Matrix& b, vector<double>& packed){
+  int groups = (b.cols + 3) / 4;
+  packed.assign((long)groups * b.rows * 4, 0.0);
+  for (int g = 0; g < groups; g++)
+    for (int k = 0; k < b.rows; k++)
+      for (int c = 0; c < 4 && 4 * g + c < b.cols; c++)
+        packed[((long)g * b.rows + k) * 4 + c] = b.data[(long)k * b.cols + 4 * g + c];
+}
+
+/*A method to perform C = A * B with B packed by packB, 4 columns of C per register*/
+void mat_multiply_packed(const Matrix& a, const vector<double>& packedB, Matrix& c){
+  int k = a.cols, groups = (c.cols + 3) / 4;
+
+  #pragma omp parallel for collapse(2) schedule(static)
+  for (int i = 0; i < a.rows; i++) {
+    for (int g = 0; g < groups; g++) {
+      const double* ai = &a.data[(long)i * k];
+      const double* bg = &packedB[(long)g * k * 4];
+      __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+      int kk = 0;
+      for (; kk + 2 <= k; kk += 2) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ai[kk]), _mm256_loadu_pd(&bg[kk * 4])));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_set1_pd(ai[kk+1]), _mm256_loadu_pd(&bg[kk * 4 + 4])));
+      }
+      if (kk < k) acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ai[kk]), _mm256_loadu_pd(&bg[kk * 4])));
+      double out[4];
+      _mm256_storeu_pd(out, _mm256_add_pd(acc0, acc1));
+      for (int c4 = 0; c4 < 4 && 4 * g + c4 < c.cols; c4++) c.data[(long)i * c.cols + 4 * g + c4] = out[c4];
+    }
+  }
+}
+
+/*A method to multiply synchronously: the blocking call the service replaces*/
+Matrix matMultiply(const Matrix& a, const Matrix& b){
+  if (a.cols != b.rows) throw invalid_argument("inner dimensions differ");
+  vector<double> packed;
+  packB(b, packed);
+  Matrix c(a.rows, b.cols);
+  mat_multiply_packed(a, packed, c);
+  return c;
+}
+
+/*
+ * The asynchronous multiply service. Two threads live as long as the service: the packer takes
+ * submitted jobs and packs their B, the computer multiplies packed jobs with the OpenMP team and
+ * fulfils their promises. While job n is being multiplied, job n+1 is already being packed.
+ * A job whose dimensions do not match completes with an invalid_argument exception.
+ */
+class MultiplyService {
+ public:
+  MultiplyService() : submitted(QUEUE_DEPTH), packed(QUEUE_DEPTH) {
+    packer = thread([this] { packLoop(); });
+    computer = thread([this] { computeLoop(); });
+  }
+
+  ~MultiplyService(){
+    submitted.push(NULL);     //drains the jobs already submitted, then stops both stages
+    packer.join();
+    computer.join();
+  }
+
+  /*A method to queue C = A * B; blocks only while QUEUE_DEPTH jobs are already waiting to be packed*/
+  future<Matrix> submit(Matrix a, Matrix b){
+    Job* job = new Job();
+    job->a = std::move(a);
+    job->b = std::move(b);
+    future<Matrix> result = job->result.get_future();
+    submitted.push(job);
+    return result;
+  }
+
+ private:
+  void packLoop(){
+    while (true) {
+      Job* job = submitted.pop();
+      if (job && job->a.cols == job->b.rows) packB(job->b, job->packedB);
+      packed.push(job);
+      if (!job) return;
+    }
+  }
+
+  void computeLoop(){
+    while (true) {
+      Job* job = packed.pop();
+      if (!job) return;
+      if (job->a.cols != job->b.rows) {
+        job->result.set_exception(make_exception_ptr(invalid_argument("inner dimensions differ")));
+      } else {
+        Matrix c(job->a.rows, job->b.cols);
+        mat_multiply_packed(job->a, job->packedB, c);
+        job->result.set_value(std::move(c));
+      }
+      delete job;
+    }
+  }
+
+  JobQueue submitted, packed;
+  thread packer, computer;
+};
+
+/*
+ * A method that benchmarks jobs multiplies of size x size matrices: one after the other with the
+ * blocking matMultiply, then through the service with clients threads submitting concurrently
+ * and collecting their futures, and checks that both give the same products.
+ */
+void benchmark(int size, int jobs, int clients){
+  vector<Matrix> as(jobs, Matrix(size, size)), bs(jobs, Matrix(size, size));
+  for (int j = 0; j < jobs; j++) {
+    populateMat(as[j], 2 * j);
+    populateMat(bs[j], 2 * j + 1);
+  }
+
+  vector<Matrix> sync(jobs);
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  for (int j = 0; j < jobs; j++) sync[j] = matMultiply(as[j], bs[j]);
+  double syncMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  vector<Matrix> async(jobs);
+  start = high_resolution_clock::now();
+  {
+    MultiplyService service;
+    vector<thread> threads;
+    for (int t = 0; t < clients; t++) {
+      threads.push_back(thread([&, t] {
+        vector<future<Matrix> > pending;
+        for (int j = t; j < jobs; j += clients) pending.push_back(service.submit(as[j], bs[j]));
+        for (int j = t, p = 0; j < jobs; j += clients, p++) async[j] = pending[p].get();
+      }));
+    }
+    for (thread& t : threads) t.join();
+  }
+  double asyncMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  long mismatches = 0;
+  for (int j = 0; j < jobs; j++)
+    for (long e = 0; e < (long)size * size; e++)
+      if (sync[j].data[e] != async[j].data[e]) mismatches++;
+
+  cout<<jobs<<" multiplies of "<<size<<"x"<<size<<" matrices"<<endl;
+  cout<<"blocking matMultiply:          "<<syncMs<<"ms, "<<jobs / syncMs * 1000<<" multiplies/s"<<endl;
+  cout<<"service, "<<clients<<" submitting threads: "<<asyncMs<<"ms, "<<jobs / asyncMs * 1000<<" multiplies/s"<<endl;
+  cout<<"mismatches = "<<mismatches<<endl;
+
+  MultiplyService service;     //a job with mismatched dimensions reports through its future
+  try {
+    service.submit(Matrix(2, 3), Matrix(2, 3)).get();
+  } catch (const invalid_argument& e) {
+    cout<<"mismatched job: "<<e.what()<<endl;
+  }
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 3) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> <jobs> [client_threads]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  int jobs = atoi(argv[2]);
+  int clients = argc > 3 ? atoi(argv[3]) : 4;
+  if (size < 1 || jobs < 1 || clients < 1) {
+    cout<<"the matrix size, job count and client count must be positive"<<endl;
+    return 1;
+  }
+  benchmark(size, jobs, clients);
+  return 0;
+}
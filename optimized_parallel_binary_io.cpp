@@ -0,0 +1,360 @@
+/**
+ * Parallel program to store matrices in a binary file format (row-major or tiled) and to
+ * multiply them straight from mmap'ed files, writing C into a mapped output file
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_binary_io.cpp -o optimized_parallel_binary_io
+ *  (run): ./optimized_parallel_binary_io write <file> <matrix_size> [rowmajor|tiled]
+ *         ./optimized_parallel_binary_io info <file>
+ *         ./optimized_parallel_binary_io multiply <fileA> <fileB> <fileC> [verify]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <string>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define MAT_MAGIC 0x3154414d584d4f43ULL   //"COMXMAT1"
+#define MAT_VERSION 1
+#define MAT_ALIGNMENT 4096                //the data starts on a page so it can be mapped and used in place
+#define DEFAULT_TILE 64
+#define CHECKSUM_CHUNK (1 << 20)          //bytes hashed per parallel chunk
+
+enum DType { FLOAT64 = 1, FLOAT32 = 2 };
+enum Layout { ROW_MAJOR = 0, TILED = 1 };
+
+/*
+ * The file header, stored at offset 0 and padded to MAT_ALIGNMENT bytes.
+ * TILED data holds ceil(rows/tile) x ceil(cols/tile) zero padded tile x tile tiles in
+ * row-major tile order, each tile row-major. The checksum covers the dataBytes after dataOffset.
+ */
+struct MatHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t dtype;
+  uint32_t layout;
+  uint32_t tile;
+  uint64_t rows, cols;
+  uint64_t alignment;
+  uint64_t dataOffset;
+  uint64_t dataBytes;
+  uint64_t checksum;
+};
+
+/*A matrix whose elements live in a mapped file*/
+struct MappedMat {
+  MatHeader header;
+  double* data;
+  void* base;
+  size_t length;
+
+  int tilesPerRow() const { return (header.cols + header.tile - 1) / header.tile; }
+
+  /*Pointer to the tile whose top left element is (r, c), and the stride between its rows*/
+  double* tileAt(long r, long c, long& ld) const {
+    if (header.layout == ROW_MAJOR) {
+      ld = header.cols;
+      return data + r * header.cols + c;
+    }
+    ld = header.tile;
+    long t = header.tile;
+    return data + ((r / t) * tilesPerRow() + c / t) * t * t;
+  }
+};
+
+
+/*A method to compute the checksum of the data: a multiply-xor hash of every 1 MB chunk, combined in order*/
+uint64_t checksum(const void* data, uint64_t bytes){
+  long chunks = (bytes + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+  uint64_t* partial = new uint64_t[chunks];
+
+  #pragma omp parallel for schedule(static)
+  for (long ch = 0; ch < chunks; ch++) {
+    const unsigned char* p = (const unsigned char*)data + ch * CHECKSUM_CHUNK;
+    uint64_t n = min((uint64_t)CHECKSUM_CHUNK, bytes - ch * CHECKSUM_CHUNK);
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+    uint64_t w;
+    uint64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      memcpy(&w, p + i, 8);
+      h = (h ^ (w * 0xff51afd7ed558ccdULL)) * 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 29;
+    }
+    for (; i < n; i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+    partial[ch] = h;
+  }
+
+  uint64_t h = bytes;
+  for (long ch = 0; ch < chunks; ch++) h = (h ^ partial[ch]) * 0x9e3779b97f4a7c15ULL + (h >> 31);
+  delete[] partial;
+  return h;
+}
+
+/*A method to set out = a * b; returns false if the product does not fit in 64 bits*/
+inline bool mulChecked(uint64_t a, uint64_t b, uint64_t& out){
+  if (a != 0 && b > UINT64_MAX / a) return false;
+  out = a * b;
+  return true;
+}
+
+/*
+ * A method to compute the data bytes a header's shape and layout call for; returns false for
+ * an unknown layout, a TILED header without a tile size, or a size that overflows
+ */
+bool expectedDataBytes(const MatHeader& h, uint64_t& bytes){
+  uint64_t elements;
+  if (h.layout == ROW_MAJOR) {
+    if (!mulChecked(h.rows, h.cols, elements)) return false;
+  }
+  else if (h.layout == TILED) {
+    if (h.tile == 0) return false;
+    uint64_t tr = h.rows / h.tile + (h.rows % h.tile != 0), tc = h.cols / h.tile + (h.cols % h.tile != 0);
+    uint64_t tiles;
+    if (!mulChecked(tr, tc, tiles) || !mulChecked(tiles, (uint64_t)h.tile * h.tile, elements)) return false;
+  }
+  else return false;
+  return mulChecked(elements, sizeof(double), bytes);
+}
+
+/*A method to fill in a header for a rows x cols float64 matrix*/
+MatHeader makeHeader(uint64_t rows, uint64_t cols, Layout layout, uint32_t tile){
+  MatHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = MAT_MAGIC;
+  h.version = MAT_VERSION;
+  h.dtype = FLOAT64;
+  h.layout = layout;
+  h.tile = layout == TILED ? tile : 0;
+  h.rows = rows;
+  h.cols = cols;
+  h.alignment = MAT_ALIGNMENT;
+  h.dataOffset = MAT_ALIGNMENT;
+  if (!expectedDataBytes(h, h.dataBytes)) { cerr<<"a "<<rows<<"x"<<cols<<" matrix is too large"<<endl; exit(1); }
+  return h;
+}
+
+/*
+ * A method to create a matrix file of the given shape and map it writable. The caller fills
+ * data and then calls closeMat with finish set, which stores the checksum and header.
+ */
+MappedMat createMat(const string& path, uint64_t rows, uint64_t cols, Layout layout, uint32_t tile){
+  MappedMat m;
+  m.header = makeHeader(rows, cols, layout, tile);
+  m.length = m.header.dataOffset + m.header.dataBytes;
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, m.length) != 0) { perror(path.c_str()); exit(1); }
+  m.base = mmap(NULL, m.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m.base == MAP_FAILED) { perror("mmap"); exit(1); }
+  m.data = (double*)((char*)m.base + m.header.dataOffset);
+  return m;
+}
+
+/*
+ * A method to map an existing matrix file read-only. Nothing is read here apart from the
+ * header page: elements are paged in on demand by the kernel that touches them. The header is
+ * checked against the file so that the kernels never index past the mapping: the data size
+ * must be exactly the one the shape and layout call for.
+ */
+MappedMat openMat(const string& path, bool verify){
+  MappedMat m;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) { perror(path.c_str()); exit(1); }
+  struct stat st;
+  fstat(fd, &st);
+  m.length = st.st_size;
+  if (m.length < sizeof(MatHeader)) { cerr<<path<<": too short for a matrix header"<<endl; exit(1); }
+  m.base = mmap(NULL, m.length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m.base == MAP_FAILED) { perror("mmap"); exit(1); }
+
+  memcpy(&m.header, m.base, sizeof(MatHeader));
+  const MatHeader& h = m.header;
+  if (h.magic != MAT_MAGIC || h.version != MAT_VERSION) { cerr<<path<<": not a matrix file"<<endl; exit(1); }
+  if (h.dtype != FLOAT64) { cerr<<path<<": only float64 data is supported by the kernels"<<endl; exit(1); }
+  uint64_t expected;
+  if (h.rows == 0 || h.cols == 0 || !expectedDataBytes(h, expected) || h.dataBytes != expected
+      || h.dataOffset % MAT_ALIGNMENT != 0 || h.dataOffset > m.length || h.dataBytes > m.length - h.dataOffset) {
+    cerr<<path<<": corrupt header"<<endl;
+    exit(1);
+  }
+  m.data = (double*)((char*)m.base + h.dataOffset);
+
+  if (verify && checksum(m.data, h.dataBytes) != h.checksum) { cerr<<path<<": checksum mismatch"<<endl; exit(1); }
+  //row-major data is streamed by the kernel; tiles are visited in tile order, so keep the default read-ahead
+  if (h.layout == ROW_MAJOR) madvise(m.base, m.length, MADV_SEQUENTIAL);
+  return m;
+}
+
+/*A method to unmap a matrix; with finish set the checksum is computed and the header written first*/
+void closeMat(MappedMat& m, bool finish){
+  if (finish) {
+    m.header.checksum = checksum(m.data, m.header.dataBytes);
+    memcpy(m.base, &m.header, sizeof(MatHeader));
+    msync(m.base, m.length, MS_SYNC);
+  }
+  munmap(m.base, m.length);
+}
+
+/*A method to write a random matrix file*/
+void writeRandomMat(const string& path, int size, Layout layout){
+  MappedMat m = createMat(path, size, size, layout, DEFAULT_TILE);
+  long step = layout == TILED ? DEFAULT_TILE : size;
+  std::random_device rd;
+  unsigned seed = rd();
+
+  #pragma omp parallel
+  {
+    std::mt19937 gen(seed + omp_get_thread_num());
+    std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+    #pragma omp for schedule(static)
+    for (long r = 0; r < size; r++) {
+      for (long c = 0; c < size; c += step) {
+        long ld;
+        double* t = m.tileAt(r, c, ld);
+        long rr = layout == TILED ? r % DEFAULT_TILE : 0;
+        for (long cc = 0; cc < min(step, size - c); cc++) t[rr * ld + cc] = dis(gen);
+      }
+    }
+  }
+  closeMat(m, true);
+}
+
+/*
+ * A method to perform C = A * B on mapped matrices, tile by tile: every C tile accumulates
+ * A(i, k) * row k of B over the k tiles with 256 bit vectors. The tile views work for both
+ * layouts (ld is the row stride of the tile), so no operand is ever copied or transposed.
+ */
+void mapped_mat_multiply(const MappedMat& A, const MappedMat& B, MappedMat& C){
+  long n = A.header.rows, m = A.header.cols, p = B.header.cols;
+  long T = C.header.layout == TILED ? C.header.tile : DEFAULT_TILE;
+  if (A.header.layout == TILED) T = A.header.tile;
+  if (B.header.layout == TILED && B.header.tile != T) { cerr<<"A, B and C must share the tile size"<<endl; exit(1); }
+  long tilesI = (n + T - 1) / T, tilesJ = (p + T - 1) / T;
+
+  #pragma omp parallel for collapse(2) schedule(dynamic)
+  for (long ti = 0; ti < tilesI; ti++) {
+    for (long tj = 0; tj < tilesJ; tj++) {
+      long i0 = ti * T, j0 = tj * T;
+      long rowsI = min(T, n - i0), colsJ = min(T, p - j0);
+      long jVec = colsJ - colsJ % 4;
+      long ldc;
+      double* c = C.tileAt(i0, j0, ldc);
+      for (long i = 0; i < rowsI; i++)
+        for (long j = 0; j < colsJ; j++) c[i * ldc + j] = 0;
+
+      for (long k0 = 0; k0 < m; k0 += T) {
+        long depth = min(T, m - k0);
+        long lda, ldb;
+        const double* a = A.tileAt(i0, k0, lda);
+        const double* b = B.tileAt(k0, j0, ldb);
+        for (long i = 0; i < rowsI; i++) {
+          double* ci = c + i * ldc;
+          for (long k = 0; k < depth; k++) {
+            double aik = a[i * lda + k];
+            const double* bk = b + k * ldb;
+            __m256d va = _mm256_set1_pd(aik);
+            for (long j = 0; j < jVec; j += 4) {
+              _mm256_storeu_pd(&ci[j], _mm256_add_pd(_mm256_loadu_pd(&ci[j]), _mm256_mul_pd(va, _mm256_loadu_pd(&bk[j]))));
+            }
+            for (long j = jVec; j < colsJ; j++) ci[j] += aik * bk[j];
+          }
+        }
+      }
+    }
+  }
+}
+
+/*A method to read element (r, c) of a mapped matrix, for checking*/
+double elementAt(const MappedMat& m, long r, long c){
+  long ld;
+  if (m.header.layout == ROW_MAJOR) return m.tileAt(r, c, ld)[0];
+  long t = m.header.tile;
+  return m.tileAt(r, c, ld)[(r % t) * ld + c % t];
+}
+
+/*A method to print the header of a matrix file*/
+void printInfo(const string& path){
+  MappedMat m = openMat(path, true);
+  const MatHeader& h = m.header;
+  cout<<path<<": "<<h.rows<<"x"<<h.cols<<" float64, "<<(h.layout == TILED ? "tiled" : "row-major");
+  if (h.layout == TILED) cout<<" ("<<h.tile<<"x"<<h.tile<<" tiles)";
+  cout<<", data at "<<h.dataOffset<<", "<<h.dataBytes<<" bytes, checksum "<<hex<<h.checksum<<dec<<" (verified)"<<endl;
+  closeMat(m, false);
+}
+
+/*A method to multiply two matrix files into a third one and spot check the result*/
+void multiplyFiles(const string& pathA, const string& pathB, const string& pathC, bool verify){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  MappedMat A = openMat(pathA, verify);
+  MappedMat B = openMat(pathB, verify);
+  double openTime = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  if (A.header.cols != B.header.rows) { cerr<<"inner dimensions do not match"<<endl; exit(1); }
+  Layout layout = A.header.layout == TILED ? TILED : (Layout)B.header.layout;
+  uint32_t tile = A.header.layout == TILED ? A.header.tile : (B.header.layout == TILED ? B.header.tile : DEFAULT_TILE);
+  MappedMat C = createMat(pathC, A.header.rows, B.header.cols, layout, tile);
+
+  start = high_resolution_clock::now();
+  mapped_mat_multiply(A, B, C);
+  double multiplyTime = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  std::mt19937 gen(1);
+  double maxDiff = 0;
+  for (int s = 0; s < 32; s++) {   //spot check random elements of C against dot products
+    long r = gen() % A.header.rows, c = gen() % B.header.cols;
+    double ref = 0;
+    for (long k = 0; k < (long)A.header.cols; k++) ref += elementAt(A, r, k) * elementAt(B, k, c);
+    maxDiff = max(maxDiff, fabs(ref - elementAt(C, r, c)) / max(fabs(ref), 1.0));
+  }
+
+  start = high_resolution_clock::now();
+  closeMat(C, true);
+  double writeTime = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  closeMat(A, false);
+  closeMat(B, false);
+
+  cout<<"map A and B"<<(verify ? " + verify checksums" : "")<<": "<<openTime<<"ms"<<endl;
+  cout<<"multiply from the mapped files: "<<multiplyTime<<"ms"<<endl;
+  cout<<"checksum + flush of C: "<<writeTime<<"ms"<<endl;
+  cout<<"max relative difference on 32 sampled elements = "<<maxDiff<<endl;
+}
+
+int main(int argc, const char* argv[]) {
+
+  string cmd = argc > 1 ? argv[1] : "";
+  if (cmd == "write" && argc >= 4) {
+    Layout layout = (argc > 4 && strcmp(argv[4], "tiled") == 0) ? TILED : ROW_MAJOR;
+    writeRandomMat(argv[2], atoi(argv[3]), layout);
+    printInfo(argv[2]);
+  }
+  else if (cmd == "info" && argc >= 3) {
+    printInfo(argv[2]);
+  }
+  else if (cmd == "multiply" && argc >= 5) {
+    multiplyFiles(argv[2], argv[3], argv[4], argc > 5 && strcmp(argv[5], "verify") == 0);
+  }
+  else {
+    cout<<"usage: "<<argv[0]<<" write <file> <matrix_size> [rowmajor|tiled]"<<endl;
+    cout<<"       "<<argv[0]<<" info <file>"<<endl;
+    cout<<"       "<<argv[0]<<" multiply <fileA> <fileB> <fileC> [verify]"<<endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * Parallel program to perform boolean matrix multiplication (OR of ANDs) on bit-packed
+ * matrices using the Four Russians method, and transitive closure by repeated squaring
+ *
+ * To run this program:
+ *  (compile): g++ -mavx2 -mpopcnt -std=c++11 -fopenmp optimized_parallel_boolean.cpp -o optimized_parallel_boolean
+ *  (run): ./optimized_parallel_boolean <matrix_size> [density] [closure]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define TILE_WORDS 32   //columns of C handled per task, in 64 bit words (2048 columns); keeps one table in L2
+#define ROW_BLOCK 512   //rows of C per task, to amortize building the tables
+
+/*A boolean matrix packed 64 elements per word, rows padded to a multiple of 4 words*/
+struct BitMatrix {
+  int size;
+  int words;              //words per row
+  vector<uint64_t> bits;
+
+  BitMatrix(int n) : size(n), words(((n + 63) / 64 + 3) / 4 * 4), bits((size_t)n * words, 0) {}
+  uint64_t* row(int i) { return &bits[(size_t)i * words]; }
+  const uint64_t* row(int i) const { return &bits[(size_t)i * words]; }
+  bool get(int i, int j) const { return (row(i)[j >> 6] >> (j & 63)) & 1; }
+  void set(int i, int j) { row(i)[j >> 6] |= (uint64_t)1 << (j & 63); }
+};
+
+
+/*A method to populate a boolean matrix, setting each element with the given probability*/
+void populateMat(BitMatrix& matrix, double density){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> keep(0,1);
+
+  for (int row = 0; row < matrix.size; row++) {
+    for (int col = 0; col < matrix.size; col++) {
+      if (keep(gen) < density) matrix.set(row, col);
+    }
+  }
+}
+
+/*A method to count the set elements of a boolean matrix with popcnt*/
+long countBits(const BitMatrix& matrix){
+  long count = 0;
+  #pragma omp parallel for reduction(+:count)
+  for (long w = 0; w < (long)matrix.bits.size(); w++) {
+    count += _mm_popcnt_u64(matrix.bits[w]);
+  }
+  return count;
+}
+
+/*A method to perform dst[0..n) |= src[0..n) with 256 bit vectors (n is a multiple of 4)*/
+inline void orWords(uint64_t* dst, const uint64_t* src, int n){
+  for (int w = 0; w < n; w += 4) {
+    __m256i d = _mm256_loadu_si256((const __m256i*)&dst[w]);
+    __m256i s = _mm256_loadu_si256((const __m256i*)&src[w]);
+    _mm256_storeu_si256((__m256i*)&dst[w], _mm256_or_si256(d, s));
+  }
+}
+
+/*
+ * A method to perform C = A * B over the boolean semiring with the Four Russians method.
+ * The k dimension is taken 8 bits at a time: for each group the 256 possible ORs of the
+ * 8 rows of B are tabulated, so every byte of a row of A costs one table lookup and one
+ * OR of a row slice instead of up to 8. Tasks are (word tile of C, row block of C) pairs.
+ */
+double bool_mat_multiply(const BitMatrix& matA, const BitMatrix& matB, BitMatrix& matC){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  int size = matA.size;
+  int words = matA.words;
+  int wordTiles = (words + TILE_WORDS - 1) / TILE_WORDS;
+  int rowBlocks = (size + ROW_BLOCK - 1) / ROW_BLOCK;
+  int groups = (size + 7) / 8;
+
+  #pragma omp parallel
+  {
+    vector<uint64_t> table(256 * TILE_WORDS);
+
+    #pragma omp for collapse(2) schedule(dynamic)
+    for (int wt = 0; wt < wordTiles; wt++) {
+      for (int rb = 0; rb < rowBlocks; rb++) {
+        int w0 = wt * TILE_WORDS, tw = min(words - w0, TILE_WORDS);
+        int i0 = rb * ROW_BLOCK, i1 = min(size, i0 + ROW_BLOCK);
+
+        for (int i = i0; i < i1; i++) {
+          memset(matC.row(i) + w0, 0, tw * sizeof(uint64_t));
+        }
+
+        for (int g = 0; g < groups; g++) {
+          int k0 = g * 8;
+          //table[m] is the OR of the rows k0+b of B for every bit b set in m
+          memset(&table[0], 0, tw * sizeof(uint64_t));
+          for (int m = 1; m < 256; m++) {
+            int low = __builtin_ctz(m);
+            uint64_t* dst = &table[m * TILE_WORDS];
+            memcpy(dst, &table[(m & (m - 1)) * TILE_WORDS], tw * sizeof(uint64_t));
+            if (k0 + low < size) orWords(dst, matB.row(k0 + low) + w0, tw);
+          }
+
+          for (int i = i0; i < i1; i++) {
+            unsigned byte = (matA.row(i)[g >> 3] >> ((g & 7) * 8)) & 0xff;
+            if (byte) orWords(matC.row(i) + w0, &table[byte * TILE_WORDS], tw);
+          }
+        }
+      }
+    }
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;   //Get duration in milli seconds
+}
+
+/*
+ * A method to compute the reflexive transitive closure R* of an adjacency matrix by
+ * squaring (I | R) until the number of set bits stops changing: at most log2(n) products.
+ */
+double transitive_closure(BitMatrix& matR, int& steps){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  BitMatrix tmp(matR.size);
+  for (int i = 0; i < matR.size; i++) matR.set(i, i);
+  long before = countBits(matR);
+  steps = 0;
+  while (true) {
+    bool_mat_multiply(matR, matR, tmp);
+    std::swap(matR.bits, tmp.bits);
+    steps++;
+    long after = countBits(matR);
+    if (after == before) break;
+    before = after;
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;
+}
+
+/*A method to perform the boolean product with one byte per element, as the reference*/
+void naive_bool_multiply(const BitMatrix& matA, const BitMatrix& matB, vector<char>& matC){
+  int size = matA.size;
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      char c = 0;
+      for (int k = 0; k < size && !c; k++) {
+        c = matA.get(i, k) && matB.get(k, j);
+      }
+      matC[(size_t)i * size + j] = c;
+    }
+  }
+}
+
+/*A method that multiplies two random boolean matrices and, optionally, computes a closure*/
+void matMultiply(int size, double density, bool closure){
+  BitMatrix matA(size), matB(size), matC(size);
+  populateMat(matA, density);
+  populateMat(matB, density);
+
+  cout<<"packed matrix: "<<(double)matA.bits.size() * 8 / (1 << 20)<<" MB (as double: "
+      <<(double)size * size * 8 / (1 << 20)<<" MB)"<<endl;
+
+  double duration = bool_mat_multiply(matA, matB, matC);
+  cout<<"boolean multiply: "<<duration<<"ms, "<<countBits(matC)<<" set elements"<<endl;
+
+  if (size <= 2000) {   //the byte-per-element reference is O(n^3)
+    vector<char> ref((size_t)size * size);
+    naive_bool_multiply(matA, matB, ref);
+    long mismatches = 0;
+    for (int i = 0; i < size; i++)
+      for (int j = 0; j < size; j++)
+        mismatches += ref[(size_t)i * size + j] != matC.get(i, j);
+    cout<<"mismatches against the reference = "<<mismatches<<endl;
+  }
+
+  if (closure) {
+    int steps;
+    double closureTime = transitive_closure(matA, steps);
+    cout<<"transitive closure: "<<closureTime<<"ms in "<<steps<<" squarings, "<<countBits(matA)<<" reachable pairs"<<endl;
+  }
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [density] [closure]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  double density = argc > 2 ? atof(argv[2]) : 0.01;
+  bool closure = argc > 3 && strcmp(argv[3], "closure") == 0;
+  matMultiply(size, density, closure);
+  return 0;
+}
@@ -0,0 +1,410 @@
+/**
+ * Parallel program to cache multiply results under a content hash of the operands
+ *
+ * The key of C = A * B is an AVX2 hash of the bytes of A and of B (xxhash style: 64-bit
+ * multiply-accumulate lanes, hashed in parallel chunks) together with the dimensions and the
+ * operation, so a repeated pair costs O(n^2) hashing instead of an O(n^3) multiply. Results are
+ * kept in memory within a byte budget, least recently used first out; evicted results can spill
+ * to a directory, which also survives the process.
+ *
+ * To run this program:
+ *  (compile): g++ -mavx2 -std=c++11 -fopenmp optimized_parallel_cache.cpp -o optimized_parallel_cache
+ *  (run): ./optimized_parallel_cache <matrix_size> <distinct_pairs> <requests> [memory_budget_mb] [disk_dir]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <string>
+#include <mutex>
+#include <stdexcept>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include <dirent.h>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define HASH_CHUNK (1 << 20)   //bytes hashed per task; fixed, so the hash does not depend on the thread count
+#define OP_GEMM 1
+
+static const uint64_t PRIME32_1 = 0x9E3779B1U;
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+
+/*A row-major rows x cols matrix*/
+struct Matrix {
+  int rows, cols;
+  vector<double> data;
+
+  Matrix() : rows(0), cols(0) {}
+  Matrix(int r, int c) : rows(r), cols(c), data((long)r * c) {}
+};
+
+
+/*The final mix of xxhash64: spreads every input bit over the whole word*/
+inline uint64_t avalanche(uint64_t h){
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+/*
+ * A method to hash len bytes. Eight 64-bit lanes (two AVX2 registers) take 64 bytes per step:
+ * each lane adds the 32x32->64 product of the halves of (data ^ key) and the lane-swapped data,
+ * as in XXH3, and the lanes are scrambled every 16 steps so that bits cannot cancel. The tail
+ * and the final merge are scalar.
+ */
+uint64_t hashBytes(const char* p, size_t len, uint64_t seed){
+  const __m256i key0 = _mm256_set_epi64x(PRIME64_1 + seed, PRIME64_2 - seed, PRIME64_3 ^ seed, PRIME64_1 ^ (seed << 1));
+  const __m256i key1 = _mm256_set_epi64x(PRIME64_3 + seed, PRIME64_1 - seed, PRIME64_2 ^ seed, PRIME64_3 ^ (seed << 1));
+  const __m256i prime = _mm256_set1_epi32(PRIME32_1);
+  __m256i acc0 = _mm256_set1_epi64x(seed ^ PRIME64_1), acc1 = _mm256_set1_epi64x(seed ^ PRIME64_2);
+
+  size_t stripes = len / 64;
+  for (size_t s = 0; s < stripes; s++) {
+    __m256i d0 = _mm256_loadu_si256((const __m256i*)(p + s * 64));
+    __m256i d1 = _mm256_loadu_si256((const __m256i*)(p + s * 64 + 32));
+    __m256i k0 = _mm256_xor_si256(d0, key0), k1 = _mm256_xor_si256(d1, key1);
+    acc0 = _mm256_add_epi64(acc0, _mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32)));
+    acc1 = _mm256_add_epi64(acc1, _mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32)));
+    acc0 = _mm256_add_epi64(acc0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc1 = _mm256_add_epi64(acc1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+    if ((s & 15) == 15) {
+      __m256i* accs[2] = {&acc0, &acc1};
+      for (int a = 0; a < 2; a++) {
+        __m256i x = _mm256_xor_si256(*accs[a], _mm256_srli_epi64(*accs[a], 47));
+        x = _mm256_xor_si256(x, a ? key1 : key0);
+        __m256i lo = _mm256_mul_epu32(x, prime);
+        __m256i hi = _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), prime), 32);
+        *accs[a] = _mm256_add_epi64(lo, hi);
+      }
+    }
+  }
+
+  uint64_t lanes[8];
+  _mm256_storeu_si256((__m256i*)lanes, acc0);
+  _mm256_storeu_si256((__m256i*)(lanes + 4), acc1);
+  uint64_t h = len * PRIME64_1;
+  for (int l = 0; l < 8; l++) h = (h ^ avalanche(lanes[l] * PRIME64_2)) * PRIME64_1 + PRIME64_3;
+  for (size_t i = stripes * 64; i < len; i += 8) {
+    uint64_t word = 0;
+    memcpy(&word, p + i, min((size_t)8, len - i));
+    h ^= avalanche(word * PRIME64_2);
+    h = (h << 27 | h >> 37) * PRIME64_1 + PRIME64_3;
+  }
+  return avalanche(h);
+}
+
+/*A method to hash the bytes of a matrix: fixed size chunks hashed in parallel, then merged in order*/
+uint64_t hashMat(const Matrix& m){
+  const char* p = (const char*)&m.data[0];
+  size_t len = m.data.size() * sizeof(double);
+  long chunks = (len + HASH_CHUNK - 1) / HASH_CHUNK;
+  vector<uint64_t> parts(chunks);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (long c = 0; c < chunks; c++) {
+    size_t begin = (size_t)c * HASH_CHUNK;
+    parts[c] = hashBytes(p + begin, min((size_t)HASH_CHUNK, len - begin), c);
+  }
+
+  uint64_t h = avalanche(((uint64_t)m.rows << 32) ^ (uint64_t)m.cols);
+  for (long c = 0; c < chunks; c++) h = avalanche(h ^ parts[c]) * PRIME64_1 + PRIME64_3;
+  return h;
+}
+
+
+/*The identity of a result: the hashes of both operands and the operation parameters*/
+struct CacheKey {
+  uint64_t hashA, hashB;
+  uint32_t m, k, n, op;
+
+  bool operator==(const CacheKey& o) const {
+    return hashA == o.hashA && hashB == o.hashB && m == o.m && k == o.k && n == o.n && op == o.op;
+  }
+
+  /*The file name of the entry in the disk tier*/
+  string fileName() const {
+    char name[96];
+    snprintf(name, sizeof(name), "%016llx-%016llx-%ux%ux%u-%u.mat", (unsigned long long)hashA, (unsigned long long)hashB, m, k, n, op);
+    return name;
+  }
+
+  static bool parse(const char* name, CacheKey& key){
+    unsigned long long a, b;
+    int used = 0;
+    if (sscanf(name, "%16llx-%16llx-%ux%ux%u-%u.mat%n", &a, &b, &key.m, &key.k, &key.n, &key.op, &used) != 6) return false;
+    if (name[used] != '\0') return false;
+    key.hashA = a;
+    key.hashB = b;
+    return true;
+  }
+};
+
+struct CacheKeyHash {
+  size_t operator()(const CacheKey& key) const {
+    return avalanche(key.hashA ^ (key.hashB * PRIME64_1) ^ ((uint64_t)key.m << 40) ^ ((uint64_t)key.n << 20) ^ key.k ^ ((uint64_t)key.op << 60));
+  }
+};
+
+/*
+ * Multiply results by content. Both tiers are LRU lists with a byte budget: get() moves a hit to
+ * the front, a memory entry pushed out of its budget is written to the disk tier (if there is
+ * one), and a disk hit is read back into memory. All methods are serialised by one mutex.
+ */
+class ResultCache {
+ public:
+  int memoryHits = 0, diskHits = 0, misses = 0, spills = 0;
+
+  /*A memory-only cache*/
+  explicit ResultCache(size_t memoryBudget)
+    : memoryBudget(memoryBudget), diskBudget(0), memoryBytes(0), diskBytes(0) {}
+
+  /*
+   * A cache with a disk tier in diskDir. Entries already in diskDir are picked up, and the
+   * least recently used of them deleted if they exceed diskBudget, so the budget must be given.
+   */
+  ResultCache(size_t memoryBudget, const string& diskDir, size_t diskBudget)
+    : memoryBudget(memoryBudget), diskBudget(diskBudget), dir(diskDir), memoryBytes(0), diskBytes(0) {
+    if (dir.empty()) return;
+    if (diskBudget == 0) throw invalid_argument("a disk tier needs a non-zero budget");
+    DIR* d = opendir(dir.c_str());
+    if (!d) { perror(dir.c_str()); dir.clear(); return; }
+    while (dirent* e = readdir(d)) {
+      CacheKey key;
+      if (!CacheKey::parse(e->d_name, key)) continue;
+      diskOrder.push_back(key);
+      diskEntries[key] = --diskOrder.end();
+      diskBytes += entryBytes(key);
+    }
+    closedir(d);
+    trimDisk();
+  }
+
+  /*A method to copy the cached result for key into c; returns false on a miss*/
+  bool get(const CacheKey& key, Matrix& c){
+    lock_guard<mutex> guard(lock);
+    auto m = memory.find(key);
+    if (m != memory.end()) {
+      memoryOrder.splice(memoryOrder.begin(), memoryOrder, m->second);
+      c = m->second->second;
+      memoryHits++;
+      return true;
+    }
+    auto d = diskEntries.find(key);
+    if (d != diskEntries.end()) {   //the file leaves the disk tier either way, read back or unreadable
+      Matrix back;
+      bool ok = readEntry(key, back);
+      diskBytes -= entryBytes(key);
+      diskOrder.erase(d->second);
+      diskEntries.erase(d);
+      remove((dir + "/" + key.fileName()).c_str());
+      if (ok) {
+        insert(key, back);
+        c = back;
+        diskHits++;
+        return true;
+      }
+    }
+    misses++;
+    return false;
+  }
+
+  void put(const CacheKey& key, const Matrix& c){
+    lock_guard<mutex> guard(lock);
+    if (memory.count(key)) return;
+    insert(key, c);
+  }
+
+  size_t residentBytes() const { return memoryBytes; }
+  size_t spilledBytes() const { return diskBytes; }
+
+ private:
+  static size_t entryBytes(const CacheKey& key){ return (size_t)key.m * key.n * sizeof(double); }
+
+  void insert(const CacheKey& key, const Matrix& c){
+    size_t bytes = entryBytes(key);
+    if (bytes > memoryBudget) { spill(key, c); return; }
+    memoryOrder.push_front(make_pair(key, c));
+    memory[key] = memoryOrder.begin();
+    memoryBytes += bytes;
+    while (memoryBytes > memoryBudget) {
+      pair<CacheKey, Matrix>& victim = memoryOrder.back();
+      spill(victim.first, victim.second);
+      memoryBytes -= entryBytes(victim.first);
+      memory.erase(victim.first);
+      memoryOrder.pop_back();
+    }
+  }
+
+  void spill(const CacheKey& key, const Matrix& c){
+    if (dir.empty() || entryBytes(key) > diskBudget || diskEntries.count(key)) return;
+    FILE* f = fopen((dir + "/" + key.fileName()).c_str(), "wb");
+    if (!f) return;
+    bool ok = fwrite(&c.data[0], sizeof(double), c.data.size(), f) == c.data.size();
+    if (fclose(f) != 0 || !ok) { remove((dir + "/" + key.fileName()).c_str()); return; }
+    diskOrder.push_front(key);
+    diskEntries[key] = diskOrder.begin();
+    diskBytes += entryBytes(key);
+    spills++;
+    trimDisk();
+  }
+
+  void trimDisk(){
+    while (diskBytes > diskBudget) {
+      const CacheKey& victim = diskOrder.back();
+      remove((dir + "/" + victim.fileName()).c_str());
+      diskBytes -= entryBytes(victim);
+      diskEntries.erase(victim);
+      diskOrder.pop_back();
+    }
+  }
+
+  /*A method to read an entry file into c; false unless it holds exactly m * n doubles*/
+  bool readEntry(const CacheKey& key, Matrix& c){
+    FILE* f = fopen((dir + "/" + key.fileName()).c_str(), "rb");
+    if (!f) return false;
+    c = Matrix(key.m, key.n);
+    bool ok = fread(&c.data[0], sizeof(double), c.data.size(), f) == c.data.size() && fgetc(f) == EOF;
+    fclose(f);
+    return ok;
+  }
+
+  size_t memoryBudget, diskBudget;
+  string dir;
+  size_t memoryBytes, diskBytes;
+  list<pair<CacheKey, Matrix> > memoryOrder;
+  unordered_map<CacheKey, list<pair<CacheKey, Matrix> >::iterator, CacheKeyHash> memory;
+  list<CacheKey> diskOrder;
+  unordered_map<CacheKey, list<CacheKey>::iterator, CacheKeyHash> diskEntries;
+  mutex lock;
+};
+
+
+/*A method to populate a matrix with random numbers*/
+void populateMat(Matrix& matrix, unsigned seed){
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+  for (double& v : matrix.data) v = dis(gen);
+}
+
+/*A method to perform C = A * B: B packed into column panels of 4, 4 columns of C per register*/
+void mat_multiply(const Matrix& a, const Matrix& b, Matrix& c){
+  int k = a.cols, n = b.cols, groups = (n + 3) / 4;
+  vector<double> packed((long)groups * k * 4, 0.0);
+  #pragma omp parallel for
+  for (int g = 0; g < groups; g++)
+    for (int kk = 0; kk < k; kk++)
+      for (int c4 = 0; c4 < 4 && 4 * g + c4 < n; c4++)
+        packed[((long)g * k + kk) * 4 + c4] = b.data[(long)kk * n + 4 * g + c4];
+
+  c = Matrix(a.rows, n);
+  #pragma omp parallel for collapse(2) schedule(static)
+  for (int i = 0; i < a.rows; i++) {
+    for (int g = 0; g < groups; g++) {
+      const double* ai = &a.data[(long)i * k];
+      const double* bg = &packed[(long)g * k * 4];
+      __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+      int kk = 0;
+      for (; kk + 2 <= k; kk += 2) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ai[kk]), _mm256_loadu_pd(&bg[kk * 4])));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_set1_pd(ai[kk+1]), _mm256_loadu_pd(&bg[kk * 4 + 4])));
+      }
+      if (kk < k) acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ai[kk]), _mm256_loadu_pd(&bg[kk * 4])));
+      double out[4];
+      _mm256_storeu_pd(out, _mm256_add_pd(acc0, acc1));
+      for (int c4 = 0; c4 < 4 && 4 * g + c4 < n; c4++) c.data[(long)i * n + 4 * g + c4] = out[c4];
+    }
+  }
+}
+
+/*A method to perform C = A * B through the cache: hash both operands, compute only on a miss*/
+void cached_mat_multiply(ResultCache& cache, const Matrix& a, const Matrix& b, Matrix& c){
+  CacheKey key = {hashMat(a), hashMat(b), (uint32_t)a.rows, (uint32_t)a.cols, (uint32_t)b.cols, OP_GEMM};
+  if (cache.get(key, c)) return;
+  mat_multiply(a, b, c);
+  cache.put(key, c);
+}
+
+/*
+ * A method that replays requests multiplies drawn from pairs distinct (A, B) pairs, skewed so
+ * that a few pairs are popular, without and with the cache, and checks both give the same C.
+ */
+void benchmark(int size, int pairs, int requests, size_t memoryBudget, const string& dir){
+  vector<Matrix> as(pairs, Matrix(size, size)), bs(pairs, Matrix(size, size));
+  for (int p = 0; p < pairs; p++) {
+    populateMat(as[p], 2 * p);
+    populateMat(bs[p], 2 * p + 1);
+  }
+  std::mt19937 gen(3);
+  std::geometric_distribution<> popularity(2.0 / (pairs + 1));
+  vector<int> trace(requests);
+  for (int r = 0; r < requests; r++) trace[r] = popularity(gen) % pairs;
+
+  Matrix c, ref;
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  for (int r = 0; r < requests; r++) mat_multiply(as[trace[r]], bs[trace[r]], c);
+  double plain = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  ResultCache cache(memoryBudget, dir, 8 * memoryBudget);
+  long mismatches = 0;
+  double cachedMs = 0;
+  for (int r = 0; r < requests; r++) {
+    start = high_resolution_clock::now();
+    cached_mat_multiply(cache, as[trace[r]], bs[trace[r]], c);
+    cachedMs += (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+    if (r % 8 == 0) {         //spot check against a fresh multiply, outside the timing
+      mat_multiply(as[trace[r]], bs[trace[r]], ref);
+      for (size_t e = 0; e < ref.data.size(); e++) mismatches += ref.data[e] != c.data[e];
+    }
+  }
+
+  Matrix single = as[0];
+  start = high_resolution_clock::now();
+  uint64_t h = hashMat(single);
+  double hashMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  single.data[single.data.size() / 2] += 1e-12;
+
+  cout<<requests<<" multiplies of "<<size<<"x"<<size<<" over "<<pairs<<" distinct pairs"<<endl;
+  cout<<"without cache: "<<plain<<"ms"<<endl;
+  cout<<"with cache:    "<<cachedMs<<"ms ("<<cache.memoryHits<<" memory hits, "<<cache.diskHits<<" disk hits, "
+      <<cache.misses<<" misses, "<<cache.spills<<" spilled)"<<endl;
+  cout<<"hashing one operand: "<<hashMs<<"ms, "<<size * (double)size * 8 / hashMs / 1e6<<" GB/s; "
+      <<"one ulp-sized change "<<(hashMat(single) != h ? "changes" : "does NOT change")<<" the hash"<<endl;
+  cout<<"resident "<<cache.residentBytes() / 1048576.0<<"MB, on disk "<<cache.spilledBytes() / 1048576.0<<"MB"<<endl;
+  cout<<"mismatches = "<<mismatches<<endl;
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 4) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> <distinct_pairs> <requests> [memory_budget_mb] [disk_dir]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  int pairs = atoi(argv[2]);
+  int requests = atoi(argv[3]);
+  size_t budget = (size_t)((argc > 4 ? atof(argv[4]) : 64) * 1048576);
+  string dir = argc > 5 ? argv[5] : "";
+  if (size < 1 || pairs < 1 || requests < 1) {
+    cout<<"the matrix size, pair count and request count must be positive"<<endl;
+    return 1;
+  }
+  benchmark(size, pairs, requests, budget, dir);
+  return 0;
+}
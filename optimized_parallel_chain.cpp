@@ -0,0 +1,303 @@
+/**
+ * Parallel program to evaluate a chain of matrix products A1 * A2 * ... * An with the
+ * optimal parenthesisation, pooled intermediate buffers and concurrent independent products
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_chain.cpp -o optimized_parallel_chain
+ *  (run): ./optimized_parallel_chain [d0 d1 ... dn [--density p1 ... pn]]
+ *         matrix i is d(i-1) x d(i); p1 ... pn are optional estimates of their non zero fractions
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+/*A rows x cols matrix stored row by row in one buffer of capacity doubles*/
+struct Matrix {
+  int rows, cols;
+  long capacity;
+  double* data;
+  double* row(int i) const { return data + (long)i * cols; }
+};
+
+/*
+ * A pool of matrix buffers. acquire() hands out the smallest free buffer that is large
+ * enough, and only allocates when none is; release() returns a buffer for reuse.
+ */
+struct BufferPool {
+  vector<Matrix*> free;
+  omp_lock_t lock;
+  int allocations, reuses;
+
+  BufferPool() : allocations(0), reuses(0) { omp_init_lock(&lock); }
+  ~BufferPool() {
+    for (size_t b = 0; b < free.size(); b++) { delete[] free[b]->data; delete free[b]; }
+    omp_destroy_lock(&lock);
+  }
+
+  Matrix* acquire(int rows, int cols){
+    long need = (long)rows * cols;
+    omp_set_lock(&lock);
+    int best = -1;
+    for (size_t b = 0; b < free.size(); b++) {
+      if (free[b]->capacity >= need && (best < 0 || free[b]->capacity < free[best]->capacity)) best = b;
+    }
+    Matrix* m;
+    if (best >= 0) {
+      m = free[best];
+      free.erase(free.begin() + best);
+      reuses++;
+    }
+    else {
+      m = new Matrix();
+      m->capacity = need;
+      m->data = new double[need];
+      allocations++;
+    }
+    omp_unset_lock(&lock);
+    m->rows = rows;
+    m->cols = cols;
+    return m;
+  }
+
+  void release(Matrix* m){
+    omp_set_lock(&lock);
+    free.push_back(m);
+    omp_unset_lock(&lock);
+  }
+};
+
+/*The optimal split points found by the parenthesisation DP*/
+struct ChainPlan {
+  int n;
+  vector<double> cost;    //cost[i*n+j]: estimated multiply-adds for A(i) .. A(j)
+  vector<double> density; //density[i*n+j]: estimated non zero fraction of that product
+  vector<int> split;      //split[i*n+j]: the product is (A(i)..A(k)) * (A(k+1)..A(j))
+};
+
+
+/*A method to populate a matrix with random values*/
+void populateMat(Matrix* matrix){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,1);
+
+  for (long e = 0; e < (long)matrix->rows * matrix->cols; e++) {
+    matrix->data[e] = dis(gen);
+  }
+}
+
+/*
+ * A method to find the parenthesisation with the fewest multiply-adds (O(n^3) DP over the
+ * shapes dims). A product X * Y costs rows(X) * cols(X) * cols(Y) * density(X), and the
+ * density of X * Y over k inner terms is estimated as 1 - (1 - dX * dY)^k.
+ */
+ChainPlan planChain(const vector<int>& dims, const vector<double>& densities){
+  ChainPlan plan;
+  int n = dims.size() - 1;
+  plan.n = n;
+  plan.cost.assign(n * n, 0);
+  plan.density.assign(n * n, 1);
+  plan.split.assign(n * n, -1);
+  for (int i = 0; i < n; i++) plan.density[i*n+i] = densities[i];
+
+  for (int len = 2; len <= n; len++) {
+    for (int i = 0; i + len - 1 < n; i++) {
+      int j = i + len - 1;
+      plan.cost[i*n+j] = 1e300;
+      for (int k = i; k < j; k++) {
+        double dLeft = plan.density[i*n+k], dRight = plan.density[(k+1)*n+j];
+        double c = plan.cost[i*n+k] + plan.cost[(k+1)*n+j] + (double)dims[i] * dims[k+1] * dims[j+1] * dLeft;
+        if (c < plan.cost[i*n+j]) {
+          plan.cost[i*n+j] = c;
+          plan.split[i*n+j] = k;
+          plan.density[i*n+j] = 1 - pow(1 - dLeft * dRight, (double)dims[k+1]);
+        }
+      }
+    }
+  }
+  return plan;
+}
+
+/*A method to write the parenthesisation of A(i) .. A(j)*/
+string planString(const ChainPlan& plan, int i, int j){
+  if (i == j) {
+    ostringstream name;
+    name<<"A"<<i+1;
+    return name.str();
+  }
+  int k = plan.split[i*plan.n+j];
+  return "(" + planString(plan, i, k) + " " + planString(plan, k+1, j) + ")";
+}
+
+/*A method to get the cost of evaluating the chain from left to right*/
+double leftToRightCost(const vector<int>& dims, const vector<double>& densities){
+  double cost = 0, d = densities[0];
+  for (size_t k = 1; k + 1 < dims.size(); k++) {
+    cost += (double)dims[0] * dims[k] * dims[k+1] * d;
+    d = 1 - pow(1 - d * densities[k], (double)dims[k]);
+  }
+  return cost;
+}
+
+/*
+ * A method to perform C = A * B. Row i of C accumulates A[i][k] * row k of B with 256 bit
+ * vectors, skipping zeros of A. Rows are spread with a taskloop so that the kernel shares
+ * the threads with other products that run at the same time.
+ */
+void multiply(const Matrix* matA, const Matrix* matB, Matrix* matC){
+  int cols = matC->cols;
+  int jEnd = cols - cols % 4;
+
+  #pragma omp taskloop grainsize(8)
+  for (int i = 0; i < matA->rows; i++) {
+    double* c = matC->row(i);
+    for (int j = 0; j < cols; j++) c[j] = 0;
+    const double* a = matA->row(i);
+    for (int k = 0; k < matA->cols; k++) {
+      if (a[k] == 0) continue;
+      const double* b = matB->row(k);
+      __m256d va = _mm256_set1_pd(a[k]);
+      for (int j = 0; j < jEnd; j += 4) {
+        _mm256_storeu_pd(&c[j], _mm256_add_pd(_mm256_loadu_pd(&c[j]), _mm256_mul_pd(va, _mm256_loadu_pd(&b[j]))));
+      }
+      for (int j = jEnd; j < cols; j++) c[j] += a[k] * b[j];
+    }
+  }
+}
+
+/*
+ * A method to evaluate A(i) .. A(j) following the plan. The two halves of a split do not
+ * depend on each other and run as concurrent tasks; intermediates go back to the pool as
+ * soon as they have been consumed.
+ */
+Matrix* evaluate(const ChainPlan& plan, const vector<Matrix*>& inputs, int i, int j, BufferPool& pool){
+  if (i == j)
+    return inputs[i];
+
+  int k = plan.split[i*plan.n+j];
+  Matrix *left, *right;
+  #pragma omp task shared(left, plan, inputs, pool)
+  left = evaluate(plan, inputs, i, k, pool);
+  #pragma omp task shared(right, plan, inputs, pool)
+  right = evaluate(plan, inputs, k+1, j, pool);
+  #pragma omp taskwait
+
+  Matrix* result = pool.acquire(left->rows, right->cols);
+  multiply(left, right, result);
+  if (i != k) pool.release(left);
+  if (k+1 != j) pool.release(right);
+  return result;
+}
+
+/*A method to evaluate the chain from left to right, the way repeated calls to the multiply would*/
+Matrix* evaluateLeftToRight(const vector<Matrix*>& inputs, BufferPool& pool){
+  Matrix* acc = inputs[0];
+  for (size_t m = 1; m < inputs.size(); m++) {
+    Matrix* next = pool.acquire(acc->rows, inputs[m]->cols);
+    multiply(acc, inputs[m], next);
+    if (m > 1) pool.release(acc);
+    acc = next;
+  }
+  return acc;
+}
+
+/*A method that builds random matrices for the chain, evaluates it both ways and compares*/
+void chainMultiply(const vector<int>& dims, const vector<double>& densities){
+  int n = dims.size() - 1;
+  std::mt19937 gen(n);
+  std::uniform_real_distribution<> keep(0,1);
+  vector<Matrix*> inputs(n);
+  for (int m = 0; m < n; m++) {
+    inputs[m] = new Matrix();
+    inputs[m]->rows = dims[m];
+    inputs[m]->cols = dims[m+1];
+    inputs[m]->capacity = (long)dims[m] * dims[m+1];
+    inputs[m]->data = new double[inputs[m]->capacity];
+    populateMat(inputs[m]);
+    if (densities[m] < 1) {
+      for (long e = 0; e < inputs[m]->capacity; e++)
+        if (keep(gen) >= densities[m]) inputs[m]->data[e] = 0;
+    }
+  }
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();
+  ChainPlan plan = planChain(dims, densities);
+  double planTime = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  BufferPool pool;
+  Matrix* planned;
+  start = high_resolution_clock::now();
+  #pragma omp parallel
+  #pragma omp single
+  planned = evaluate(plan, inputs, 0, n-1, pool);
+  double plannedTime = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  int plannedAllocations = pool.allocations, plannedReuses = pool.reuses;
+
+  BufferPool naivePool;
+  Matrix* naive;
+  start = high_resolution_clock::now();
+  #pragma omp parallel
+  #pragma omp single
+  naive = evaluateLeftToRight(inputs, naivePool);
+  double naiveTime = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  double maxDiff = 0;
+  for (long e = 0; e < (long)planned->rows * planned->cols; e++)
+    maxDiff = max(maxDiff, fabs(planned->data[e] - naive->data[e]) / max(fabs(naive->data[e]), 1.0));
+
+  cout<<"plan: "<<planString(plan, 0, n-1)<<" (found in "<<planTime<<"ms)"<<endl;
+  cout<<"estimated multiply-adds: planned "<<plan.cost[n-1]<<", left to right "<<leftToRightCost(dims, densities)<<endl;
+  cout<<"planned chain:       "<<plannedTime<<"ms, "<<plannedAllocations<<" buffers allocated, "<<plannedReuses<<" reused"<<endl;
+  cout<<"left to right chain: "<<naiveTime<<"ms, "<<naivePool.allocations<<" buffers allocated, "<<naivePool.reuses<<" reused"<<endl;
+  cout<<"max relative difference = "<<maxDiff<<endl;
+
+  if (n > 1) {
+    pool.release(planned);
+    naivePool.release(naive);
+  }
+  for (int m = 0; m < n; m++) {
+    delete[] inputs[m]->data;
+    delete inputs[m];
+  }
+}
+
+int main(int argc, const char* argv[]) {
+
+  vector<int> dims;
+  vector<double> densities;
+  bool densityArgs = false;
+  for (int a = 1; a < argc; a++) {   //dimensions, then the densities after --density
+    if (strcmp(argv[a], "--density") == 0) densityArgs = true;
+    else if (densityArgs) densities.push_back(atof(argv[a]));
+    else dims.push_back(atoi(argv[a]));
+  }
+  if (dims.empty() && !densityArgs) {
+    int example[] = { 300, 350, 150, 50, 100, 200, 250 };   //the textbook example, scaled by 10
+    dims.assign(example, example + 7);
+  }
+  bool valid = dims.size() >= 2 && (!densityArgs || densities.size() == dims.size() - 1);
+  for (size_t d = 0; d < dims.size(); d++) valid = valid && dims[d] > 0;
+  for (size_t d = 0; d < densities.size(); d++) valid = valid && densities[d] > 0 && densities[d] <= 1;
+  if (!valid) {
+    cout<<"usage: "<<argv[0]<<" [d0 d1 ... dn [--density p1 ... pn]]"<<endl;
+    cout<<"       dimensions are positive, and there is one density in (0, 1] per matrix"<<endl;
+    return 1;
+  }
+  densities.resize(dims.size() - 1, 1.0);
+  chainMultiply(dims, densities);
+  return 0;
+}
@@ -0,0 +1,351 @@
+/**
+ * Parallel program to run the tiled matrix multiply as C++20 coroutines on an executor
+ *
+ * Every (i,j) tile of C is a task that walks the k tiles and can yield to the executor between
+ * them, so a huge multiply shares the worker threads with latency-sensitive work instead of
+ * holding each worker for a whole tile row. The demo measures how long small high priority
+ * requests wait while a multiply is running, with and without yielding.
+ *
+ * To run this program:
+ *  (compile): g++ -std=c++20 -pthread optimized_parallel_coroutine.cpp -o optimized_parallel_coroutine
+ *  (run): ./optimized_parallel_coroutine <matrix_size> [workers] [k_tiles_per_yield]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <cmath>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define S 50
+
+enum Priority { NORMAL, HIGH };
+
+/*
+ * A countdown that either resumes a waiting coroutine or wakes a blocked thread when it reaches
+ * zero. It is counted down from a final awaiter, once the finished coroutine is suspended, so the
+ * waiter may destroy that coroutine as soon as it runs.
+ */
+struct Latch {
+  atomic<int> remaining;
+  coroutine_handle<> waiter;
+  mutex lock;
+  condition_variable opened;
+  bool done = false;
+
+  explicit Latch(int count) : remaining(count) {}
+
+  coroutine_handle<> countDown(){
+    if (remaining.fetch_sub(1, memory_order_acq_rel) != 1) return noop_coroutine();
+    if (waiter) return waiter;
+    lock_guard<mutex> guard(lock);
+    done = true;
+    opened.notify_all();
+    return noop_coroutine();
+  }
+
+  void wait(){
+    unique_lock<mutex> guard(lock);
+    opened.wait(guard, [this] { return done; });
+  }
+};
+
+/*
+ * A lazily started coroutine. Awaiting a Task runs it and resumes the awaiter when it finishes;
+ * alternatively a Latch can be attached and the Task posted to an executor.
+ */
+class Task {
+ public:
+  struct promise_type {
+    coroutine_handle<> continuation;
+    Latch* latch = nullptr;
+
+    Task get_return_object(){ return Task(coroutine_handle<promise_type>::from_promise(*this)); }
+    suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      coroutine_handle<> await_suspend(coroutine_handle<promise_type> h) noexcept {
+        promise_type& p = h.promise();
+        if (p.continuation) return p.continuation;
+        if (p.latch) return p.latch->countDown();
+        return noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { terminate(); }
+  };
+
+  explicit Task(coroutine_handle<promise_type> h) : handle(h) {}
+  Task(Task&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+  Task(const Task&) = delete;
+  ~Task(){ if (handle) handle.destroy(); }
+
+  bool await_ready() const noexcept { return false; }
+  coroutine_handle<> await_suspend(coroutine_handle<> awaiter) noexcept {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+  void await_resume() noexcept {}
+
+  coroutine_handle<promise_type> handle;
+};
+
+/*
+ * A fixed pool of worker threads resuming coroutines from two FIFO queues; HIGH is always
+ * drained first. schedule() moves the awaiting coroutine onto the pool, yield() sends it to the
+ * back of its queue so whatever else is waiting runs first.
+ */
+class Executor {
+ public:
+  explicit Executor(int workers){
+    for (int w = 0; w < workers; w++) threads.push_back(thread([this] { run(); }));
+  }
+
+  ~Executor(){
+    {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+    }
+    ready.notify_all();
+    for (thread& t : threads) t.join();
+  }
+
+  void post(coroutine_handle<> h, Priority priority = NORMAL){
+    {
+      lock_guard<mutex> guard(lock);
+      queues[priority].push_back(h);
+    }
+    ready.notify_one();
+  }
+
+  struct ScheduleAwaiter {
+    Executor& executor;
+    Priority priority;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(coroutine_handle<> h){ executor.post(h, priority); }
+    void await_resume() const noexcept {}
+  };
+  ScheduleAwaiter schedule(Priority priority = NORMAL){ return ScheduleAwaiter{*this, priority}; }
+  ScheduleAwaiter yield(){ return ScheduleAwaiter{*this, NORMAL}; }
+
+ private:
+  void run(){
+    while (true) {
+      coroutine_handle<> h;
+      {
+        unique_lock<mutex> guard(lock);
+        ready.wait(guard, [this] { return stopping || !queues[HIGH].empty() || !queues[NORMAL].empty(); });
+        deque<coroutine_handle<> >& q = !queues[HIGH].empty() ? queues[HIGH] : queues[NORMAL];
+        if (q.empty()) return;
+        h = q.front();
+        q.pop_front();
+      }
+      h.resume();
+    }
+  }
+
+  vector<thread> threads;
+  deque<coroutine_handle<> > queues[2];
+  mutex lock;
+  condition_variable ready;
+  bool stopping = false;
+};
+
+/*A method to run task on the executor and block the calling thread until it has finished*/
+void syncWait(Executor& executor, Task& task, Priority priority = NORMAL){
+  Latch latch(1);
+  task.handle.promise().latch = &latch;
+  executor.post(task.handle, priority);
+  latch.wait();
+}
+
+/*A method to start every task on the executor and resume the awaiting coroutine once all have finished*/
+struct WhenAll {
+  Executor& executor;
+  vector<Task>& tasks;
+  Latch latch;
+
+  WhenAll(Executor& e, vector<Task>& t) : executor(e), tasks(t), latch((int)t.size()) {}
+
+  bool await_ready() const noexcept { return tasks.empty(); }
+  void await_suspend(coroutine_handle<> h){
+    latch.waiter = h;
+    for (Task& t : tasks) {
+      t.handle.promise().latch = &latch;
+      executor.post(t.handle);
+    }
+  }
+  void await_resume() const noexcept {}
+};
+
+
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to return a transposed copy, leaving the matrix untouched*/
+double** transposeCopy(double** matrix, int size){
+  double** trans = initMat(size);
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      trans[col][row] = matrix[row][col];
+    }
+  }
+  return trans;
+}
+
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*
+ * The task for tile (i,j) of C: the k tile loop of tiled_mat_multiply, yielding to the executor
+ * after every yieldEvery k tiles (never if yieldEvery is 0).
+ */
+Task tile_task(Executor& executor, double** matA, double** trans_matB, double** matC, int size, int i, int j, int yieldEvery){
+  int iEnd = min(i + S, size), jEnd = min(j + S, size);
+  for (int k = 0, step = 1; k < size; k += S, step++) {
+    int kEnd = min(k + S, size);
+    for (int ii = i; ii < iEnd; ii++) {
+      for (int jj = j; jj < jEnd; jj++) {
+        double sum = 0;
+        for (int kk = k; kk < kEnd; kk++) {
+          sum += matA[ii][kk] * trans_matB[jj][kk];
+        }
+        matC[ii][jj] += sum;
+      }
+    }
+    if (yieldEvery > 0 && step % yieldEvery == 0 && kEnd < size) co_await executor.yield();
+  }
+}
+
+/*A coroutine computing matC = A * B: one tile task per tile of C, all awaited together*/
+Task tiled_mat_multiply(Executor& executor, double** matA, double** trans_matB, double** matC, int size, int yieldEvery){
+  vector<Task> tiles;
+  for (int i = 0; i < size; i += S)
+    for (int j = 0; j < size; j += S)
+      tiles.push_back(tile_task(executor, matA, trans_matB, matC, size, i, j, yieldEvery));
+  co_await WhenAll(executor, tiles);
+}
+
+/*A latency-sensitive request: it only has to get onto a worker*/
+Task probe(){
+  co_return;
+}
+
+/*
+ * A method that runs one multiply on the executor while a client thread issues a high priority
+ * probe every millisecond, and reports the multiply time and how long the probes waited.
+ */
+void run(Executor& executor, double** matA, double** trans_matB, double** matC, int size, int yieldEvery){
+  for (int i = 0; i < size; i++)
+    for (int j = 0; j < size; j++) matC[i][j] = 0;
+
+  atomic<bool> finished(false);
+  vector<double> waits;
+  thread client([&] {
+    while (!finished.load()) {
+      Task t = probe();
+      high_resolution_clock::time_point posted = high_resolution_clock::now();
+      syncWait(executor, t, HIGH);
+      waits.push_back((double)duration_cast<nanoseconds>( high_resolution_clock::now() - posted ).count()/1000000);
+      this_thread::sleep_for(milliseconds(1));
+    }
+  });
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  Task multiply = tiled_mat_multiply(executor, matA, trans_matB, matC, size, yieldEvery);
+  syncWait(executor, multiply);
+  double duration = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  finished = true;
+  client.join();
+
+  double total = 0, worst = 0;
+  for (double w : waits) { total += w; worst = max(worst, w); }
+  cout<<(yieldEvery ? "yield every " + to_string(yieldEvery) + " k tiles: " : "never yield:        ")
+      <<duration<<"ms, "<<waits.size()<<" probes, mean wait "<<(waits.empty() ? 0 : total / waits.size())
+      <<"ms, max wait "<<worst<<"ms"<<endl;
+}
+
+void matMultiply(int size, int workers, int yieldEvery){
+  double** matA = initMat(size);
+  double** matB = initMat(size);
+  double** matC = initMat(size);
+  populateMat(matA, size);
+  populateMat(matB, size);
+  double** trans_matB = transposeCopy(matB, size);
+
+  {
+    Executor executor(workers);
+    run(executor, matA, trans_matB, matC, size, 0);
+    run(executor, matA, trans_matB, matC, size, yieldEvery);
+  }
+
+  double maxDiff = 0;
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      double ref = 0;
+      for (int k = 0; k < size; k++) ref += matA[i][k] * matB[k][j];
+      maxDiff = max(maxDiff, fabs(ref - matC[i][j]) / ref);
+    }
+  }
+  cout<<"max relative difference = "<<maxDiff<<endl;
+
+  freeMat(matA, size);
+  freeMat(matB, size);
+  freeMat(matC, size);
+  freeMat(trans_matB, size);
+}
+
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [workers] [k_tiles_per_yield]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  int workers = argc > 2 ? atoi(argv[2]) : max(1u, thread::hardware_concurrency());
+  int yieldEvery = argc > 3 ? atoi(argv[3]) : 1;
+  if (size < 1 || workers < 1 || yieldEvery < 1) {
+    cout<<"the matrix size, worker count and yield interval must be positive"<<endl;
+    return 1;
+  }
+  matMultiply(size, workers, yieldEvery);
+  return 0;
+}
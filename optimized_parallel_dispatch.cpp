@@ -0,0 +1,341 @@
+/**
+ * Parallel program to perform matrix-matrix multiplication choosing between a dense AVX kernel,
+ * a block-sparse tiled kernel and a CSR kernel from the measured density of the left operand
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_dispatch.cpp -o optimized_parallel_dispatch
+ *  (run): ./optimized_parallel_dispatch <matrix_size> [density] [random|block]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define S 48     //tile size of the tiled grid, multiple of 4 so tile rows are whole 256 bit vectors
+
+/*
+ * Relative cost of one useful multiply-add in each kernel, measured against the dense
+ * AVX kernel. The block-sparse kernel pays for its tile bookkeeping, the CSR kernel for
+ * having no reuse of B across rows of A.
+ */
+#define DENSE_COST 1.0
+#define BLOCK_COST 1.3
+#define CSR_COST 2.5
+
+enum Kernel { DENSE, BLOCK_SPARSE, CSR };
+
+/*A sparse matrix in compressed sparse row format*/
+struct CSRMatrix {
+  int rows, cols;
+  vector<int> rowPtr;     //row i holds entries rowPtr[i] .. rowPtr[i+1]-1
+  vector<int> colIdx;
+  vector<double> values;
+};
+
+/*The zero structure of a matrix found by analyzeMat*/
+struct Density {
+  long nnz;                 //non zero elements
+  int tiles;                //tiles per side of the S x S grid
+  vector<char> tileNonZero; //tiles*tiles flags, 1 if the tile has at least one non zero
+  long nonZeroTiles;
+};
+
+
+/*A method to initialize a matrix*/
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to get the transpose matrix of a given matrix*/
+double** getTranspose(double** matrix, int size){
+  for (int row = 0; row < size; row++) {
+    for (int col = row+1; col < size; col++) {
+      std::swap(matrix[row][col], matrix[col][row]);
+    }
+  }
+  return matrix;
+}
+
+/*A method to populate a matrix with random values*/
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*
+ * A method to populate a matrix with random values at the given density. With block set,
+ * whole S x S tiles are either kept or zeroed; otherwise single elements are.
+ */
+void populateSparseMat(double** matrix, int size, double density, bool block){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);
+  std::uniform_real_distribution<> keep(0,1);
+
+  int tiles = (size + S - 1) / S;
+  vector<char> keepTile(tiles * tiles);
+  for (int t = 0; t < tiles * tiles; t++) keepTile[t] = keep(gen) < density;
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      bool k = block ? keepTile[(row / S) * tiles + col / S] : keep(gen) < density;
+      matrix[row][col] = k ? dis(gen) : 0;
+    }
+  }
+}
+
+/*A method to count the non zeros and mark the non zero tiles of a matrix in one parallel pass*/
+Density analyzeMat(double** matrix, int size){
+  Density d;
+  d.tiles = (size + S - 1) / S;
+  d.tileNonZero.assign(d.tiles * d.tiles, 0);
+  long nnz = 0, nonZeroTiles = 0;
+
+  #pragma omp parallel for reduction(+:nnz, nonZeroTiles) schedule(dynamic)
+  for (int ti = 0; ti < d.tiles; ti++) {         //each thread owns a band of tile rows, so flags need no locking
+    for (int row = ti * S; row < min(size, ti * S + S); row++) {
+      for (int tk = 0; tk < d.tiles; tk++) {
+        int count = 0;
+        for (int col = tk * S; col < min(size, tk * S + S); col++) {
+          count += matrix[row][col] != 0;
+        }
+        if (count && !d.tileNonZero[ti * d.tiles + tk]) {
+          d.tileNonZero[ti * d.tiles + tk] = 1;
+          nonZeroTiles++;
+        }
+        nnz += count;
+      }
+    }
+  }
+  d.nnz = nnz;
+  d.nonZeroTiles = nonZeroTiles;
+  return d;
+}
+
+/*A method to convert a dense matrix to CSR*/
+CSRMatrix toCSR(double** matrix, int size){
+  CSRMatrix csr;
+  csr.rows = csr.cols = size;
+  csr.rowPtr.assign(size + 1, 0);
+
+  vector<int> counts(size, 0);
+  #pragma omp parallel for
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      if (matrix[row][col] != 0) counts[row]++;
+    }
+  }
+  for (int row = 0; row < size; row++) {
+    csr.rowPtr[row+1] = csr.rowPtr[row] + counts[row];
+  }
+  csr.colIdx.resize(csr.rowPtr[size]);
+  csr.values.resize(csr.rowPtr[size]);
+
+  #pragma omp parallel for
+  for (int row = 0; row < size; row++) {
+    int p = csr.rowPtr[row];
+    for (int col = 0; col < size; col++) {
+      if (matrix[row][col] != 0) {
+        csr.colIdx[p] = col;
+        csr.values[p++] = matrix[row][col];
+      }
+    }
+  }
+  return csr;
+}
+
+/*A method to sum the 4 lanes of a 256 bit vector*/
+inline double reduce1(__m256d c){
+  double tempresult[4];
+  _mm256_storeu_pd(tempresult, c);
+  return tempresult[0]+tempresult[1]+tempresult[2]+tempresult[3];
+}
+
+/*A method to get the dot product of a[k0..k1) and b[k0..k1)*/
+inline double dot(const double* a, const double* b, int k0, int k1){
+  __m256d c = _mm256_setzero_pd();
+  int k = k0;
+  for (; k + 4 <= k1; k += 4) {
+    c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&a[k]), _mm256_loadu_pd(&b[k])));
+  }
+  double sum = reduce1(c);
+  for (; k < k1; k++) {
+    sum += a[k]*b[k];
+  }
+  return sum;
+}
+
+/*A method to perform the dense AVX multiplication*/
+void mat_multiply_avx(double **matA, double **trans_matB, double **matC, int size){
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      matC[i][j] = dot(matA[i], trans_matB[j], 0, size);
+    }
+  }
+}
+
+/*A method to perform the tiled multiplication, skipping every k tile that is all zeros in A*/
+void block_sparse_mat_multiply(double **matA, double **trans_matB, double **matC, int size, const Density& d){
+  #pragma omp parallel for schedule(dynamic)
+  for (int ti = 0; ti < d.tiles; ti++) {
+    int i0 = ti * S, i1 = min(size, i0 + S);
+    for (int i = i0; i < i1; i++)
+      for (int j = 0; j < size; j++) matC[i][j] = 0;
+
+    for (int tj = 0; tj < d.tiles; tj++) {
+      int j0 = tj * S, j1 = min(size, j0 + S);
+      for (int tk = 0; tk < d.tiles; tk++) {
+        if (!d.tileNonZero[ti * d.tiles + tk])
+          continue;
+        int k0 = tk * S, k1 = min(size, k0 + S);
+        for (int i = i0; i < i1; i++) {
+          for (int j = j0; j < j1; j++) {
+            matC[i][j] += dot(matA[i], trans_matB[j], k0, k1);
+          }
+        }
+      }
+    }
+  }
+}
+
+/*A method to perform C = A * B with A in CSR, streaming rows of B (not transposed)*/
+void spmm_csr(const CSRMatrix& csr, double **matB, double **matC, int size){
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int i = 0; i < size; i++) {
+    double* c = matC[i];
+    for (int j = 0; j < size; j++) c[j] = 0;
+    for (int p = csr.rowPtr[i]; p < csr.rowPtr[i+1]; p++) {
+      const double* b = matB[csr.colIdx[p]];
+      __m256d v = _mm256_set1_pd(csr.values[p]);
+      int j = 0;
+      for (; j + 4 <= size; j += 4) {
+        _mm256_storeu_pd(&c[j], _mm256_add_pd(_mm256_loadu_pd(&c[j]), _mm256_mul_pd(v, _mm256_loadu_pd(&b[j]))));
+      }
+      for (; j < size; j++) {
+        c[j] += csr.values[p] * b[j];
+      }
+    }
+  }
+}
+
+/*A method to pick the kernel with the lowest predicted cost for the given zero structure of A*/
+Kernel chooseKernel(const Density& d, int size, double* predicted){
+  double n = size;
+  predicted[DENSE] = DENSE_COST * n * n * n;
+  predicted[BLOCK_SPARSE] = BLOCK_COST * (double)d.nonZeroTiles * S * n * S;
+  predicted[CSR] = CSR_COST * (double)d.nnz * n;
+
+  Kernel best = DENSE;
+  if (predicted[BLOCK_SPARSE] < predicted[best]) best = BLOCK_SPARSE;
+  if (predicted[CSR] < predicted[best]) best = CSR;
+  return best;
+}
+
+/*
+ * A method to multiply two matrices through the kernel that suits the density of A.
+ * The decision and the predicted cost of every kernel are logged.
+ */
+double dispatch_mat_multiply(double **matA, double **matB, double **matC, int size){
+  const char* names[] = { "dense", "block-sparse", "csr" };
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  Density d = analyzeMat(matA, size);
+  double predicted[3];
+  Kernel kernel = chooseKernel(d, size, predicted);
+
+  cout<<"density = "<<100.0*d.nnz/((double)size*size)<<"%, non zero tiles = "<<d.nonZeroTiles<<"/"<<(long)d.tiles*d.tiles<<endl;
+  for (int k = 0; k < 3; k++) {
+    cout<<"  predicted cost "<<names[k]<<" = "<<predicted[k]/1e6<<" M multiply-add equivalents"<<(k == kernel ? "  <- chosen" : "")<<endl;
+  }
+
+  if (kernel == CSR) {
+    CSRMatrix csr = toCSR(matA, size);
+    spmm_csr(csr, matB, matC, size);
+  }
+  else {
+    double** trans_matB = getTranspose(matB,size);
+    if (kernel == DENSE) mat_multiply_avx(matA, trans_matB, matC, size);
+    else block_sparse_mat_multiply(matA, trans_matB, matC, size, d);
+    getTranspose(trans_matB, size);   //give B back to the caller unchanged
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;   //Get duration in milli seconds
+}
+
+/*A method that multiplies a random matrix of the given density through the dispatcher and checks it*/
+void matMultiply(int size, double density, bool block){
+  double** matA = initMat(size);
+  double** matB = initMat(size);
+  double** matC = initMat(size);
+  double** matRef = initMat(size);
+  populateSparseMat(matA, size, density, block);
+  populateMat(matB, size);
+
+  double duration = dispatch_mat_multiply(matA, matB, matC, size);
+
+  double** trans_matB = getTranspose(matB,size);
+  high_resolution_clock::time_point start = high_resolution_clock::now();
+  mat_multiply_avx(matA, trans_matB, matRef, size);
+  double dense = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  double maxDiff = 0;
+  for (int i = 0; i < size; i++)
+    for (int j = 0; j < size; j++)
+      maxDiff = max(maxDiff, fabs(matRef[i][j] - matC[i][j]));
+
+  cout<<"dispatched multiply (including analysis): "<<duration<<"ms"<<endl;
+  cout<<"dense multiply:                           "<<dense<<"ms"<<endl;
+  cout<<"max difference = "<<maxDiff<<endl;
+
+  freeMat(matA, size);
+  freeMat(matB, size);
+  freeMat(matC, size);
+  freeMat(matRef, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [density] [random|block]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  double density = argc > 2 ? atof(argv[2]) : 1.0;
+  bool block = argc > 3 && strcmp(argv[3], "block") == 0;
+  matMultiply(size, density, block);
+  return 0;
+}
@@ -0,0 +1,260 @@
+/**
+ * Parallel program to perform matrix-matrix multiplication with a fused epilogue
+ * (bias add, ReLU, clamp) applied to each register tile before it is stored
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_epilogue.cpp -o optimized_parallel_epilogue
+ *  (run): ./optimized_parallel_epilogue <matrix_size>
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+
+/*A method to initialize a matrix*/
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to get the transpose matrix of a given matrix*/
+double** getTranspose(double** matrix, int size){
+  for (int row = 0; row < size; row++) {
+    for (int col = row+1; col < size; col++) {
+      std::swap(matrix[row][col], matrix[col][row]);
+    }
+  }
+  return matrix;
+}
+
+/*A method to populate a matrix with random values*/
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(-4,4);//Centered so that ReLU and clamp actually cut values
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+
+/*
+ * Epilogues. Each one is applied to a 1x4 register tile (4 consecutive columns of a row)
+ * while it is still in a register, and to single elements for the column tail.
+ */
+
+/*Leaves the tile unchanged*/
+struct Identity {
+  __m256d operator()(__m256d v, int, int) const { return v; }
+  double operator()(double v, int, int) const { return v; }
+};
+
+/*Adds a per-column bias vector*/
+struct BiasAdd {
+  const double* bias;
+  explicit BiasAdd(const double* b) : bias(b) {}
+  __m256d operator()(__m256d v, int, int col) const { return _mm256_add_pd(v, _mm256_loadu_pd(&bias[col])); }
+  double operator()(double v, int, int col) const { return v + bias[col]; }
+};
+
+/*max(v, 0)*/
+struct ReLU {
+  __m256d operator()(__m256d v, int, int) const { return _mm256_max_pd(v, _mm256_setzero_pd()); }
+  double operator()(double v, int, int) const { return v > 0 ? v : 0; }
+};
+
+/*min(max(v, lo), hi)*/
+struct Clamp {
+  double lo, hi;
+  Clamp(double l, double h) : lo(l), hi(h) {}
+  __m256d operator()(__m256d v, int, int) const {
+    return _mm256_min_pd(_mm256_max_pd(v, _mm256_set1_pd(lo)), _mm256_set1_pd(hi));
+  }
+  double operator()(double v, int, int) const { return v < lo ? lo : (v > hi ? hi : v); }
+};
+
+/*Applies First and then Second*/
+template <typename First, typename Second>
+struct Compose {
+  First first;
+  Second second;
+  Compose(const First& f, const Second& s) : first(f), second(s) {}
+  __m256d operator()(__m256d v, int row, int col) const { return second(first(v, row, col), row, col); }
+  double operator()(double v, int row, int col) const { return second(first(v, row, col), row, col); }
+};
+
+/*A helper to build a composed epilogue without spelling out the types*/
+template <typename First, typename Second>
+Compose<First, Second> compose(const First& f, const Second& s){
+  return Compose<First, Second>(f, s);
+}
+
+
+/*A method to sum the 4 lanes of each of c0..c3 into one vector {sum(c0), sum(c1), sum(c2), sum(c3)}*/
+inline __m256d reduce4(__m256d c0, __m256d c1, __m256d c2, __m256d c3){
+  __m256d t0 = _mm256_hadd_pd(c0, c1);   //{c0[0]+c0[1], c1[0]+c1[1], c0[2]+c0[3], c1[2]+c1[3]}
+  __m256d t1 = _mm256_hadd_pd(c2, c3);
+  __m256d lo = _mm256_permute2f128_pd(t0, t1, 0x20);
+  __m256d hi = _mm256_permute2f128_pd(t0, t1, 0x31);
+  return _mm256_add_pd(lo, hi);
+}
+
+/*A method to sum the 4 lanes of a 256 bit vector*/
+inline double reduce1(__m256d c){
+  double tempresult[4];
+  _mm256_storeu_pd(tempresult, c);
+  return tempresult[0]+tempresult[1]+tempresult[2]+tempresult[3];
+}
+
+/*
+ * A method to perform C = epilogue(A * B) where trans_matB holds B transposed.
+ * Each thread computes 4 output columns of a row at a time, applies the epilogue
+ * to the register tile and stores it, so C is written exactly once.
+ */
+template <typename Epilogue>
+double mat_multiply_avx(double **matA, double **trans_matB, double **matC, int size, const Epilogue& epilogue){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  int kEnd = size - size % 4;   //last k covered by full 256 bit loads
+
+   #pragma omp parallel for
+    for (int i = 0; i < size; i++) {
+        const double* a = matA[i];
+        int j = 0;
+        for (; j + 4 <= size; j += 4) {
+            const double* b0 = trans_matB[j];
+            const double* b1 = trans_matB[j+1];
+            const double* b2 = trans_matB[j+2];
+            const double* b3 = trans_matB[j+3];
+            __m256d c0 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd();
+            __m256d c2 = _mm256_setzero_pd(), c3 = _mm256_setzero_pd();
+
+            for (int k = 0; k < kEnd; k += 4) {
+                __m256d va = _mm256_loadu_pd(&a[k]);
+                c0 = _mm256_add_pd(c0, _mm256_mul_pd(va, _mm256_loadu_pd(&b0[k])));
+                c1 = _mm256_add_pd(c1, _mm256_mul_pd(va, _mm256_loadu_pd(&b1[k])));
+                c2 = _mm256_add_pd(c2, _mm256_mul_pd(va, _mm256_loadu_pd(&b2[k])));
+                c3 = _mm256_add_pd(c3, _mm256_mul_pd(va, _mm256_loadu_pd(&b3[k])));
+            }
+            __m256d tile = reduce4(c0, c1, c2, c3);
+            if (kEnd < size) {              //remaining k that do not fill a 256 bit vector
+              double tail[4] = {0, 0, 0, 0};
+              for (int k = kEnd; k < size; k++) {
+                tail[0] += a[k]*b0[k]; tail[1] += a[k]*b1[k];
+                tail[2] += a[k]*b2[k]; tail[3] += a[k]*b3[k];
+              }
+              tile = _mm256_add_pd(tile, _mm256_loadu_pd(tail));
+            }
+            _mm256_storeu_pd(&matC[i][j], epilogue(tile, i, j));  //epilogue runs on the register tile, then one store
+        }
+        for (; j < size; j++) {             //remaining columns that do not fill a tile
+            __m256d c = _mm256_setzero_pd();
+            for (int k = 0; k < kEnd; k += 4) {
+                c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&a[k]), _mm256_loadu_pd(&trans_matB[j][k])));
+            }
+            double sum = reduce1(c);
+            for (int k = kEnd; k < size; k++) {
+                sum += a[k]*trans_matB[j][k];
+            }
+            matC[i][j] = epilogue(sum, i, j);
+        }
+    }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;   //Get duration in milli seconds
+}
+
+/*A method to apply bias add, ReLU and clamp as separate passes over C (the unfused baseline)*/
+double apply_separate_passes(double **matC, const double* bias, double lo, double hi, int size){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) matC[i][j] += bias[j];
+  }
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) matC[i][j] = matC[i][j] > 0 ? matC[i][j] : 0;
+  }
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) matC[i][j] = matC[i][j] < lo ? lo : (matC[i][j] > hi ? hi : matC[i][j]);
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;
+}
+
+/*A method that multiplies two random matrices with and without the fused epilogue and compares the results*/
+void matMultiply(int size){
+  double** matA = initMat(size);    //Initialize matrix A
+  double** matB = initMat(size);    //Initialize matrix B
+  double** matC = initMat(size);    //Result of the unfused path
+  double** matD = initMat(size);    //Result of the fused path
+  populateMat(matA , size);
+  populateMat(matB, size);
+
+  double* bias = new double[size];
+  std::mt19937 gen(size);
+  std::uniform_real_distribution<> dis(-1,1);
+  for (int j = 0; j < size; j++) bias[j] = dis(gen);
+  double lo = 0, hi = 6.0 * sqrt((double)size);   //ReLU6 style cap, scaled to the magnitude of the products
+
+  double** trans_matB = getTranspose(matB,size);
+
+  double unfused = mat_multiply_avx(matA, trans_matB, matC, size, Identity());
+  double passes = apply_separate_passes(matC, bias, lo, hi, size);
+  double fused = mat_multiply_avx(matA, trans_matB, matD, size,
+                                  compose(compose(BiasAdd(bias), ReLU()), Clamp(lo, hi)));
+
+  double maxDiff = 0;
+  for (int i = 0; i < size; i++)
+    for (int j = 0; j < size; j++)
+      maxDiff = max(maxDiff, fabs(matC[i][j] - matD[i][j]));
+
+  cout<<"multiply + separate epilogue passes: "<<unfused<<"ms + "<<passes<<"ms = "<<unfused+passes<<"ms"<<endl;
+  cout<<"multiply with fused epilogue:        "<<fused<<"ms"<<endl;
+  cout<<"max difference = "<<maxDiff<<endl;
+
+  delete[] bias;
+  freeMat(matA, size);
+  freeMat(matB, size);
+  freeMat(matC, size);
+  freeMat(matD, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size>"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  matMultiply(size);
+  return 0;
+}
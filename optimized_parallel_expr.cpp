@@ -0,0 +1,363 @@
+/**
+ * Parallel program with a lazy expression layer for matrix expressions such as A*B + C*D - E
+ *
+ * Operators on matrices build an expression tree instead of computing anything. Assigning the
+ * tree to a Matrix flattens it into a sum of scaled products and scaled matrices, and a single
+ * pass over the tiles of the result computes it: the elementwise terms seed a tile buffer,
+ * every product accumulates into it block by block, and each tile is stored once. No product
+ * or partial sum is materialised; only operands that are themselves products are evaluated first.
+ * The saving over separate multiplies and sums is the temporaries and the elementwise passes
+ * over them, so it is largest when the products are cheap relative to the matrix size.
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_expr.cpp -o optimized_parallel_expr
+ *  (run): ./optimized_parallel_expr <matrix_size>
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <cmath>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define MC 64       //rows of a tile of the result
+#define NC 64       //columns of a tile of the result, a multiple of 4
+#define KC 256      //k steps of a product per pass over a tile, so the B panels in use stay in L1
+
+
+/*The base of every node of an expression, so that operators only match expressions*/
+template<typename E>
+struct Expr {
+  const E& self() const { return static_cast<const E&>(*this); }
+};
+
+struct Matrix;
+
+/*Matrices are held in a tree by reference, inner nodes by value, so a tree may outlive its statement*/
+template<typename E> struct Stored { typedef E type; };
+template<> struct Stored<Matrix> { typedef const Matrix& type; };
+
+template<typename L, typename R>
+struct ProductExpr : Expr<ProductExpr<L, R> > {
+  typename Stored<L>::type l;
+  typename Stored<R>::type r;
+  ProductExpr(const L& l, const R& r) : l(l), r(r) {}
+};
+
+/*l + sign * r*/
+template<typename L, typename R>
+struct SumExpr : Expr<SumExpr<L, R> > {
+  typename Stored<L>::type l;
+  typename Stored<R>::type r;
+  double sign;
+  SumExpr(const L& l, const R& r, double sign) : l(l), r(r), sign(sign) {}
+};
+
+template<typename E>
+struct ScaleExpr : Expr<ScaleExpr<E> > {
+  double scale;
+  typename Stored<E>::type e;
+  ScaleExpr(double scale, const E& e) : scale(scale), e(e) {}
+};
+
+template<typename L, typename R>
+ProductExpr<L, R> operator*(const Expr<L>& l, const Expr<R>& r){ return ProductExpr<L, R>(l.self(), r.self()); }
+template<typename L, typename R>
+SumExpr<L, R> operator+(const Expr<L>& l, const Expr<R>& r){ return SumExpr<L, R>(l.self(), r.self(), 1); }
+template<typename L, typename R>
+SumExpr<L, R> operator-(const Expr<L>& l, const Expr<R>& r){ return SumExpr<L, R>(l.self(), r.self(), -1); }
+template<typename E>
+ScaleExpr<E> operator*(double s, const Expr<E>& e){ return ScaleExpr<E>(s, e.self()); }
+template<typename E>
+ScaleExpr<E> operator-(const Expr<E>& e){ return ScaleExpr<E>(-1, e.self()); }
+
+
+/*
+ * An expression flattened to sum(coef * A * B) + sum(coef * M). Operands that had to be
+ * evaluated on their own (products used as factors) are owned by temps.
+ */
+struct Plan {
+  struct Product { double coef; const Matrix *a, *b; };
+  struct Term { double coef; const Matrix* m; };
+  vector<Product> products;
+  vector<Term> terms;
+  vector<unique_ptr<Matrix> > temps;
+};
+
+/*A row-major rows x cols matrix; assigning an expression evaluates it*/
+struct Matrix : Expr<Matrix> {
+  int rows, cols;
+  vector<double> data;
+
+  Matrix() : rows(0), cols(0) {}
+  Matrix(int r, int c) : rows(r), cols(c), data((long)r * c) {}
+
+  template<typename E>
+  Matrix(const Expr<E>& e) : rows(0), cols(0) { *this = e; }
+
+  template<typename E>
+  Matrix& operator=(const Expr<E>& e);
+
+  double* row(int i){ return &data[(long)i * cols]; }
+  const double* row(int i) const { return &data[(long)i * cols]; }
+};
+
+template<typename E> void collect(const E& e, double coef, Plan& plan);
+
+/*A method to turn a factor of a product into a matrix and a coefficient, evaluating it if it is not one*/
+inline const Matrix* factor(const Matrix& m, double&, Plan&){ return &m; }
+
+template<typename E>
+const Matrix* factor(const ScaleExpr<E>& e, double& coef, Plan& plan){
+  coef *= e.scale;
+  return factor(e.e, coef, plan);
+}
+
+template<typename E>
+const Matrix* factor(const E& e, double&, Plan& plan){
+  plan.temps.push_back(unique_ptr<Matrix>(new Matrix(e)));
+  return plan.temps.back().get();
+}
+
+inline void collect(const Matrix& m, double coef, Plan& plan){
+  plan.terms.push_back(Plan::Term{coef, &m});
+}
+
+template<typename L, typename R>
+void collect(const ProductExpr<L, R>& e, double coef, Plan& plan){
+  const Matrix* a = factor(e.l, coef, plan);
+  const Matrix* b = factor(e.r, coef, plan);
+  if (a->cols != b->rows) throw invalid_argument("inner dimensions of a product differ");
+  plan.products.push_back(Plan::Product{coef, a, b});
+}
+
+template<typename L, typename R>
+void collect(const SumExpr<L, R>& e, double coef, Plan& plan){
+  collect(e.l, coef, plan);
+  collect(e.r, coef * e.sign, plan);
+}
+
+template<typename E>
+void collect(const ScaleExpr<E>& e, double coef, Plan& plan){
+  collect(e.e, coef * e.scale, plan);
+}
+
+/*
+ * A method to pack B into column panels of 4: panel g holds B[k][4g..4g+3] for every k,
+ * contiguously, so the kernel reads B with unit stride. The last panel is zero padded.
+ */
+vector<double> packB(const Matrix& b){
+  int groups = (b.cols + 3) / 4;
+  vector<double> packed((long)groups * b.rows * 4, 0.0);
+  #pragma omp parallel for
+  for (int g = 0; g < groups; g++)
+    for (int k = 0; k < b.rows; k++)
+      for (int c = 0; c < 4 && 4 * g + c < b.cols; c++)
+        packed[((long)g * b.rows + k) * 4 + c] = b.data[(long)k * b.cols + 4 * g + c];
+  return packed;
+}
+
+/*
+ * A method to add coef * A(rows r0.., k block) * B(k block, panel) to rows x 4 of the tile, for
+ * rows = 1 .. 4: every load of B feeds four rows of A.
+ */
+inline void microKernel(const Matrix& a, const double* bp, int i, int rows, int k0, int kLen,
+                        double coef, double* tile){
+  const double* a0 = a.row(i) + k0;
+  const double* a1 = a.row(i + min(1, rows - 1)) + k0;
+  const double* a2 = a.row(i + min(2, rows - 1)) + k0;
+  const double* a3 = a.row(i + min(3, rows - 1)) + k0;
+  __m256d c0 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd(), c2 = _mm256_setzero_pd(), c3 = _mm256_setzero_pd();
+  for (int k = 0; k < kLen; k++) {
+    __m256d b = _mm256_loadu_pd(&bp[k * 4]);
+    c0 = _mm256_add_pd(c0, _mm256_mul_pd(_mm256_set1_pd(a0[k]), b));
+    c1 = _mm256_add_pd(c1, _mm256_mul_pd(_mm256_set1_pd(a1[k]), b));
+    c2 = _mm256_add_pd(c2, _mm256_mul_pd(_mm256_set1_pd(a2[k]), b));
+    c3 = _mm256_add_pd(c3, _mm256_mul_pd(_mm256_set1_pd(a3[k]), b));
+  }
+  __m256d vc = _mm256_set1_pd(coef);
+  __m256d acc[4] = {c0, c1, c2, c3};
+  for (int r = 0; r < rows; r++) {
+    double* t = tile + r * NC;
+    _mm256_storeu_pd(t, _mm256_add_pd(_mm256_loadu_pd(t), _mm256_mul_pd(vc, acc[r])));
+  }
+}
+
+/*
+ * A method to evaluate a plan into out in one pass over MC x NC tiles. A tile is seeded with
+ * the weighted sum of the elementwise terms in a buffer, then each product adds to it KC
+ * steps of k at a time, every B panel slice being reused across all rows of the tile, and the
+ * tile is stored once.
+ */
+void evaluate(const Plan& plan, Matrix& out){
+  vector<vector<double> > packed(plan.products.size());
+  for (size_t p = 0; p < plan.products.size(); p++) packed[p] = packB(*plan.products[p].b);
+  int rowBlocks = (out.rows + MC - 1) / MC, colBlocks = (out.cols + NC - 1) / NC;
+
+  #pragma omp parallel
+  {
+    vector<double> tile(MC * NC);
+    #pragma omp for collapse(2) schedule(dynamic)
+    for (int ib = 0; ib < rowBlocks; ib++) {
+      for (int jb = 0; jb < colBlocks; jb++) {
+        int i0 = ib * MC, j0 = jb * NC;
+        int rows = min(MC, out.rows - i0), cols = min(NC, out.cols - j0), panels = (cols + 3) / 4;
+        for (int r = 0; r < rows; r++) {
+          double* t = &tile[r * NC];
+          for (int c = 0; c < NC; c++) t[c] = 0;
+          for (size_t e = 0; e < plan.terms.size(); e++) {
+            const double* m = plan.terms[e].m->row(i0 + r) + j0;
+            for (int c = 0; c < cols; c++) t[c] += plan.terms[e].coef * m[c];
+          }
+        }
+
+        for (size_t p = 0; p < plan.products.size(); p++) {
+          const Matrix& a = *plan.products[p].a;
+          for (int k0 = 0; k0 < a.cols; k0 += KC) {
+            int kLen = min(KC, a.cols - k0);
+            for (int g = 0; g < panels; g++) {
+              const double* bp = &packed[p][((long)(j0 / 4 + g) * a.cols + k0) * 4];
+              for (int r = 0; r < rows; r += 4)
+                microKernel(a, bp, i0 + r, min(4, rows - r), k0, kLen, plan.products[p].coef, &tile[r * NC + 4 * g]);
+            }
+          }
+        }
+
+        for (int r = 0; r < rows; r++) {
+          double* o = out.row(i0 + r) + j0;
+          for (int c = 0; c < cols; c++) o[c] = tile[r * NC + c];
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Evaluate an expression into this matrix. The shape comes from the expression; if this matrix
+ * is a factor of one of its products (say A = A*B + A), the result is built aside and swapped in,
+ * since a tile of the result is written while other tiles still read that factor.
+ */
+template<typename E>
+Matrix& Matrix::operator=(const Expr<E>& e){
+  Plan plan;
+  collect(e.self(), 1.0, plan);
+  int r = -1, c = -1;
+  bool aliased = false;
+  for (size_t p = 0; p < plan.products.size(); p++) {
+    if (r < 0) { r = plan.products[p].a->rows; c = plan.products[p].b->cols; }
+    if (plan.products[p].a->rows != r || plan.products[p].b->cols != c) throw invalid_argument("shapes of the terms differ");
+    aliased |= plan.products[p].a == this || plan.products[p].b == this;
+  }
+  for (size_t t = 0; t < plan.terms.size(); t++) {
+    if (r < 0) { r = plan.terms[t].m->rows; c = plan.terms[t].m->cols; }
+    if (plan.terms[t].m->rows != r || plan.terms[t].m->cols != c) throw invalid_argument("shapes of the terms differ");
+  }
+
+  if (aliased) {
+    Matrix result(r, c);
+    evaluate(plan, result);
+    swap(data, result.data);
+  } else {
+    if ((long)r * c != (long)data.size()) data.assign((long)r * c, 0.0);
+  }
+  rows = r; cols = c;
+  if (!aliased) evaluate(plan, *this);
+  return *this;
+}
+
+
+/*A method to populate a matrix with random numbers*/
+void populateMat(Matrix& matrix, std::mt19937& gen){
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+  for (double& v : matrix.data) v = dis(gen);
+}
+
+/*The eager path: a multiply that returns a new matrix*/
+Matrix* multiply(const Matrix& a, const Matrix& b){
+  Matrix* c = new Matrix(a.rows, b.cols);
+  Plan plan;
+  plan.products.push_back(Plan::Product{1.0, &a, &b});
+  evaluate(plan, *c);
+  return c;
+}
+
+/*The eager path: an elementwise x + sign * y that returns a new matrix*/
+Matrix* add(const Matrix& x, const Matrix& y, double sign){
+  Matrix* c = new Matrix(x.rows, x.cols);
+  #pragma omp parallel for
+  for (long e = 0; e < (long)x.data.size(); e++) c->data[e] = x.data[e] + sign * y.data[e];
+  return c;
+}
+
+double maxRelDiff(const Matrix& x, const Matrix& y){
+  double maxDiff = 0;
+  for (size_t e = 0; e < x.data.size(); e++)
+    maxDiff = max(maxDiff, fabs(x.data[e] - y.data[e]) / max(1.0, fabs(y.data[e])));
+  return maxDiff;
+}
+
+/*A method that evaluates A*B + C*D - E eagerly with temporaries and lazily in one pass, then a few other forms*/
+void matExpr(int size){
+  std::mt19937 gen(5);
+  Matrix a(size, size), b(size, size), c(size, size), d(size, size), e(size, size);
+  populateMat(a, gen); populateMat(b, gen); populateMat(c, gen); populateMat(d, gen); populateMat(e, gen);
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  Matrix* ab = multiply(a, b);
+  Matrix* cd = multiply(c, d);
+  Matrix* sum = add(*ab, *cd, 1);
+  Matrix* eager = add(*sum, e, -1);
+  double eagerMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  start = high_resolution_clock::now();
+  Matrix lazy = a*b + c*d - e;
+  double lazyMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  cout<<"A*B + C*D - E, "<<size<<"x"<<size<<endl;
+  cout<<"separate multiplies and sums: "<<eagerMs<<"ms, 4 result matrices allocated"<<endl;
+  cout<<"one fused pass:               "<<lazyMs<<"ms, 1 result matrix allocated"<<endl;
+  cout<<"max relative difference = "<<maxRelDiff(lazy, *eager)<<endl;
+
+  Matrix scaled = 0.5 * (a*b) - 2 * e + d;          //scales fold into the coefficients
+  double diff = 0;
+  for (size_t k = 0; k < scaled.data.size(); k++)
+    diff = max(diff, fabs(scaled.data[k] - (0.5 * ab->data[k] - 2 * e.data[k] + d.data[k])) / max(1.0, fabs(scaled.data[k])));
+  cout<<"0.5*(A*B) - 2*E + D:         max relative difference = "<<diff<<endl;
+
+  Matrix chained = (a*b)*c - e;                     //a product as a factor is evaluated first
+  Matrix* abc = multiply(*ab, c);
+  Matrix* ref = add(*abc, e, -1);
+  cout<<"(A*B)*C - E:                 max relative difference = "<<maxRelDiff(chained, *ref)<<endl;
+
+  Matrix before = a;
+  a = a*b + a;                                      //a is a factor of its own expression
+  Matrix* aliasRef = add(*ab, before, 1);
+  cout<<"A = A*B + A:                 max relative difference = "<<maxRelDiff(a, *aliasRef)<<endl;
+
+  delete ab; delete cd; delete sum; delete eager; delete abc; delete ref; delete aliasRef;
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size>"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  if (size < 1) {
+    cout<<"the matrix size must be positive"<<endl;
+    return 1;
+  }
+  matExpr(size);
+  return 0;
+}
@@ -0,0 +1,195 @@
+/**
+ * Parallel program to perform matrix-vector multiplication (GEMV) and multiplication by a
+ * skinny matrix of 1 to 8 columns, streaming A once, with a memory bandwidth report
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_gemv.cpp -o optimized_parallel_gemv
+ *  (run): ./optimized_parallel_gemv <matrix_size> [columns 1-8]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define REPEAT 10   //runs of each kernel; the fastest is reported
+
+
+/*A method to initialize a rows x cols matrix*/
+double** initMat(int rows, int cols){
+  double** mat = new double*[rows];
+  for (int i = 0; i < rows; i++) {
+    mat[i] = new double[cols]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int rows){
+  for (int i = 0; i < rows; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to populate a rows x cols matrix with random values*/
+void populateMat(double** matrix, int rows, int cols){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*A method to sum the 4 lanes of a 256 bit vector*/
+inline double reduce1(__m256d c){
+  double tempresult[4];
+  _mm256_storeu_pd(tempresult, c);
+  return tempresult[0]+tempresult[1]+tempresult[2]+tempresult[3];
+}
+
+/*
+ * A method to perform Y = A * X for N right hand side vectors X[0..N) of length size,
+ * writing Y[c][i]. Each row of A is loaded once and multiplied against all N vectors;
+ * U independent accumulators per vector hide the add latency when N is small, so there
+ * are N*U accumulators in registers. The vectors are tiny compared to A and stay cached.
+ */
+template <int N>
+void skinny_multiply(double **matA, double **vecX, double **vecY, int size){
+  const int U = N >= 4 ? 1 : (N == 1 ? 4 : 2);
+  int kEnd = size - size % (4 * U);
+
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < size; i++) {
+    const double* a = matA[i];
+    __m256d acc[N][U];
+    for (int c = 0; c < N; c++)
+      for (int u = 0; u < U; u++) acc[c][u] = _mm256_setzero_pd();
+
+    for (int k = 0; k < kEnd; k += 4 * U) {
+      for (int u = 0; u < U; u++) {
+        __m256d va = _mm256_loadu_pd(&a[k + 4 * u]);
+        for (int c = 0; c < N; c++) {
+          acc[c][u] = _mm256_add_pd(acc[c][u], _mm256_mul_pd(va, _mm256_loadu_pd(&vecX[c][k + 4 * u])));
+        }
+      }
+    }
+    for (int c = 0; c < N; c++) {
+      __m256d sum = acc[c][0];
+      for (int u = 1; u < U; u++) sum = _mm256_add_pd(sum, acc[c][u]);
+      double y = reduce1(sum);
+      for (int k = kEnd; k < size; k++) y += a[k] * vecX[c][k];
+      vecY[c][i] = y;
+    }
+  }
+}
+
+/*A method to dispatch to the skinny kernel compiled for the given number of columns*/
+double gemv(double **matA, double **vecX, double **vecY, int size, int columns){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  switch (columns) {
+    case 1: skinny_multiply<1>(matA, vecX, vecY, size); break;
+    case 2: skinny_multiply<2>(matA, vecX, vecY, size); break;
+    case 3: skinny_multiply<3>(matA, vecX, vecY, size); break;
+    case 4: skinny_multiply<4>(matA, vecX, vecY, size); break;
+    case 5: skinny_multiply<5>(matA, vecX, vecY, size); break;
+    case 6: skinny_multiply<6>(matA, vecX, vecY, size); break;
+    case 7: skinny_multiply<7>(matA, vecX, vecY, size); break;
+    default: skinny_multiply<8>(matA, vecX, vecY, size); break;
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;   //Get duration in milli seconds
+}
+
+/*A method to measure how fast all threads can read A (a sum over every element), the bound for GEMV*/
+double readBandwidth(double **matA, int size, double& checksum){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  double total = 0;
+  #pragma omp parallel for schedule(static) reduction(+:total)
+  for (int i = 0; i < size; i++) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    int k = 0;
+    for (; k + 8 <= size; k += 8) {
+      s0 = _mm256_add_pd(s0, _mm256_loadu_pd(&matA[i][k]));
+      s1 = _mm256_add_pd(s1, _mm256_loadu_pd(&matA[i][k+4]));
+    }
+    double s = reduce1(_mm256_add_pd(s0, s1));
+    for (; k < size; k++) s += matA[i][k];
+    total += s;
+  }
+  checksum = total;
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;
+}
+
+/*A method that multiplies a random matrix by random skinny matrices and reports the bandwidth used*/
+void matMultiply(int size, int columns){
+  double** matA = initMat(size, size);
+  double** vecX = initMat(columns, size);
+  double** vecY = initMat(columns, size);
+  populateMat(matA, size, size);
+  populateMat(vecX, columns, size);
+
+  double best = 1e30, bestRead = 1e30, checksum;
+  for (int r = 0; r < REPEAT; r++) {
+    best = min(best, gemv(matA, vecX, vecY, size, columns));
+    bestRead = min(bestRead, readBandwidth(matA, size, checksum));
+  }
+
+  double maxDiff = 0;
+  for (int c = 0; c < columns; c++) {
+    for (int i = 0; i < size; i++) {
+      double y = 0;
+      for (int k = 0; k < size; k++) y += matA[i][k] * vecX[c][k];
+      maxDiff = max(maxDiff, fabs(y - vecY[c][i]) / fabs(y));
+    }
+  }
+
+  double bytes = (double)size * size * 8 + 2.0 * columns * size * 8;   //A once, X read and Y written
+  double gbs = bytes / (best * 1e6);
+  double readGbs = (double)size * size * 8 / (bestRead * 1e6);
+
+  cout<<size<<"x"<<size<<" times "<<size<<"x"<<columns<<" on "<<omp_get_max_threads()<<" threads"<<endl;
+  cout<<"skinny multiply:   "<<best<<"ms, "<<gbs<<" GB/s, "<<2.0*size*size*columns/(best*1e6)<<" GFLOP/s"<<endl;
+  cout<<"read of A alone:   "<<bestRead<<"ms, "<<readGbs<<" GB/s"<<endl;
+  cout<<"bandwidth efficiency = "<<100.0*gbs/readGbs<<"%"<<endl;
+  cout<<"max relative difference = "<<maxDiff<<endl;
+
+  freeMat(matA, size);
+  freeMat(vecX, columns);
+  freeMat(vecY, columns);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [columns 1-8]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  int columns = argc > 2 ? atoi(argv[2]) : 1;
+  if (columns < 1 || columns > 8) {
+    cout<<"the number of columns must be between 1 and 8"<<endl;
+    return 1;
+  }
+  matMultiply(size, columns);
+  return 0;
+}
@@ -0,0 +1,281 @@
+/**
+ * Parallel program to keep C = A * B up to date while A and B change a little at a time
+ *
+ * Instead of recomputing all of C, an IncrementalProduct is told what changed: a set of rows of
+ * A (only those rows of C are recomputed), a set of columns of B (only those columns of C), or a
+ * low-rank update U * V^T of A or of B, which becomes a rank-r update of C. The cost of every
+ * update is proportional to the size of the change times n^2 instead of n^3.
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_incremental.cpp -o optimized_parallel_incremental
+ *  (run): ./optimized_parallel_incremental <matrix_size> <changed_rows_or_columns> <rank>
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define COL_BLOCK 256     //columns of C per task when forming V^T * B
+
+
+/*A method to initialize a matrix*/
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to populate a matrix with random numbers*/
+void populateMat(double** matrix, int size, std::mt19937& gen){
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*A method to perform y[0..n) += a * x[0..n)*/
+inline void axpy(double a, const double* x, double* y, int n){
+  __m256d va = _mm256_set1_pd(a);
+  int j = 0;
+  for (; j + 4 <= n; j += 4) {
+    _mm256_storeu_pd(&y[j], _mm256_add_pd(_mm256_loadu_pd(&y[j]), _mm256_mul_pd(va, _mm256_loadu_pd(&x[j]))));
+  }
+  for (; j < n; j++) y[j] += a * x[j];
+}
+
+/*A method to compute the listed rows of C = A * B, each as a sum of rows of B; B is only read*/
+void multiply_rows(double** matA, double** matB, double** matC, int size, const vector<int>& rows){
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t r = 0; r < rows.size(); r++) {
+    int i = rows[r];
+    for (int j = 0; j < size; j++) matC[i][j] = 0;
+    for (int k = 0; k < size; k++) axpy(matA[i][k], matB[k], matC[i], size);
+  }
+}
+
+/*
+ * A method to compute the listed columns of C = A * B: the columns are gathered from B into a
+ * dense size x d panel, every row of A times the panel gives d values of C
+ */
+void multiply_cols(double** matA, double** matB, double** matC, int size, const vector<int>& cols){
+  int d = cols.size();
+  vector<double> panel((long)size * d);
+  #pragma omp parallel for
+  for (int k = 0; k < size; k++)
+    for (int t = 0; t < d; t++) panel[(long)k * d + t] = matB[k][cols[t]];
+
+  #pragma omp parallel
+  {
+    vector<double> row(d);
+    #pragma omp for schedule(static)
+    for (int i = 0; i < size; i++) {
+      for (int t = 0; t < d; t++) row[t] = 0;
+      for (int k = 0; k < size; k++) axpy(matA[i][k], &panel[(long)k * d], &row[0], d);
+      for (int t = 0; t < d; t++) matC[i][cols[t]] = row[t];
+    }
+  }
+}
+
+/*The rank-r update kernel: C += U * W, U size x r and W r x size, both row-major*/
+void rank_k_update(double** matC, const double* u, const double* w, int size, int r){
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < size; i++) {
+    for (int t = 0; t < r; t++) axpy(u[(long)i * r + t], &w[(long)t * size], matC[i], size);
+  }
+}
+
+/*
+ * C = A * B kept current under changes to A and B. A and B belong to the caller: change some
+ * rows of A or columns of B in place and report them, or hand the low-rank updates over to be
+ * applied to A or B and C together.
+ */
+class IncrementalProduct {
+ public:
+  IncrementalProduct(double** matA, double** matB, int size) : matA(matA), matB(matB), size(size) {
+    matC = initMat(size);
+    vector<int> all(size);
+    for (int i = 0; i < size; i++) all[i] = i;
+    multiply_rows(matA, matB, matC, size, all);
+  }
+
+  ~IncrementalProduct(){ freeMat(matC, size); }
+
+  double** result() const { return matC; }
+
+  /*Rows of A have been changed in place: recompute those rows of C, O(d n^2)*/
+  void rowsChanged(const vector<int>& rows){
+    multiply_rows(matA, matB, matC, size, rows);
+  }
+
+  /*Columns of B have been changed in place: recompute those columns of C, O(d n^2)*/
+  void colsChanged(const vector<int>& cols){
+    multiply_cols(matA, matB, matC, size, cols);
+  }
+
+  /*
+   * A += U * V^T with U and V size x r, row-major: C += U * (V^T * B), a rank-r update of C after
+   * forming the r x n product V^T * B, O(r n^2) in all
+   */
+  void updateA(const double* u, const double* v, int r){
+    vector<double> w((long)r * size, 0.0);
+    #pragma omp parallel for schedule(static)
+    for (int j0 = 0; j0 < size; j0 += COL_BLOCK) {
+      int len = min(COL_BLOCK, size - j0);
+      for (int k = 0; k < size; k++)
+        for (int t = 0; t < r; t++) axpy(v[(long)k * r + t], matB[k] + j0, &w[(long)t * size + j0], len);
+    }
+    rank_k_update(matC, u, &w[0], size, r);
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < size; i++)
+      for (int k = 0; k < size; k++) {
+        double sum = 0;
+        for (int t = 0; t < r; t++) sum += u[(long)i * r + t] * v[(long)k * r + t];
+        matA[i][k] += sum;
+      }
+  }
+
+  /*B += U * V^T with U and V size x r, row-major: C += (A * U) * V^T, O(r n^2) in all*/
+  void updateB(const double* u, const double* v, int r){
+    vector<double> x((long)size * r), vt((long)r * size);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < size; i++) {
+      for (int t = 0; t < r; t++) x[(long)i * r + t] = 0;
+      for (int k = 0; k < size; k++) axpy(matA[i][k], &u[(long)k * r], &x[(long)i * r], r);
+    }
+    for (int k = 0; k < size; k++)
+      for (int t = 0; t < r; t++) vt[(long)t * size + k] = v[(long)k * r + t];
+    rank_k_update(matC, &x[0], &vt[0], size, r);
+    rank_k_update(matB, u, &vt[0], size, r);
+  }
+
+ private:
+  double **matA, **matB, **matC;
+  int size;
+};
+
+/*A method to return the largest relative difference between C and a full recomputation of A * B*/
+double checkAgainstFull(double** matA, double** matB, double** matC, int size, double& fullMs){
+  double** ref = initMat(size);
+  vector<int> all(size);
+  for (int i = 0; i < size; i++) all[i] = i;
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  multiply_rows(matA, matB, ref, size, all);
+  fullMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  double maxDiff = 0;
+  for (int i = 0; i < size; i++)
+    for (int j = 0; j < size; j++)
+      maxDiff = max(maxDiff, fabs(ref[i][j] - matC[i][j]) / fabs(ref[i][j]));
+  freeMat(ref, size);
+  return maxDiff;
+}
+
+/*A method to return distinct random indices in [0, size)*/
+vector<int> pick(int count, int size, std::mt19937& gen){
+  vector<int> all(size);
+  for (int i = 0; i < size; i++) all[i] = i;
+  shuffle(all.begin(), all.end(), gen);
+  return vector<int>(all.begin(), all.begin() + min(count, size));
+}
+
+/*A method that applies each kind of change to A or B and times the incremental update against a full multiply*/
+void matIncremental(int size, int changed, int rank){
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<> dis(0,8);
+  std::uniform_real_distribution<> small(-0.1,0.1);
+  double** matA = initMat(size);
+  double** matB = initMat(size);
+  populateMat(matA, size, gen);
+  populateMat(matB, size, gen);
+  IncrementalProduct product(matA, matB, size);
+  double fullMs, incMs, diff;
+  high_resolution_clock::time_point start;
+
+  vector<int> rows = pick(changed, size, gen);
+  for (int i : rows)
+    for (int k = 0; k < size; k++) matA[i][k] = dis(gen);
+  start = high_resolution_clock::now();
+  product.rowsChanged(rows);
+  incMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  diff = checkAgainstFull(matA, matB, product.result(), size, fullMs);
+  cout<<rows.size()<<" rows of A changed:    "<<incMs<<"ms (full multiply "<<fullMs<<"ms), max relative difference = "<<diff<<endl;
+
+  vector<int> cols = pick(changed, size, gen);
+  for (int k = 0; k < size; k++)
+    for (int j : cols) matB[k][j] = dis(gen);
+  start = high_resolution_clock::now();
+  product.colsChanged(cols);
+  incMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  diff = checkAgainstFull(matA, matB, product.result(), size, fullMs);
+  cout<<cols.size()<<" columns of B changed: "<<incMs<<"ms (full multiply "<<fullMs<<"ms), max relative difference = "<<diff<<endl;
+
+  vector<double> u((long)size * rank), v((long)size * rank);
+  for (double& e : u) e = small(gen);
+  for (double& e : v) e = small(gen);
+  start = high_resolution_clock::now();
+  product.updateA(&u[0], &v[0], rank);
+  incMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  diff = checkAgainstFull(matA, matB, product.result(), size, fullMs);
+  cout<<"rank "<<rank<<" update of A:      "<<incMs<<"ms (full multiply "<<fullMs<<"ms), max relative difference = "<<diff<<endl;
+
+  for (double& e : u) e = small(gen);
+  for (double& e : v) e = small(gen);
+  start = high_resolution_clock::now();
+  product.updateB(&u[0], &v[0], rank);
+  incMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  diff = checkAgainstFull(matA, matB, product.result(), size, fullMs);
+  cout<<"rank "<<rank<<" update of B:      "<<incMs<<"ms (full multiply "<<fullMs<<"ms), max relative difference = "<<diff<<endl;
+
+  for (int step = 0; step < 50; step++) {   //drift of C after many rank-r updates
+    for (double& e : u) e = small(gen);
+    for (double& e : v) e = small(gen);
+    if (step % 2) product.updateB(&u[0], &v[0], rank);
+    else product.updateA(&u[0], &v[0], rank);
+  }
+  diff = checkAgainstFull(matA, matB, product.result(), size, fullMs);
+  cout<<"after 50 more low-rank updates, max relative difference = "<<diff<<endl;
+
+  freeMat(matA, size);
+  freeMat(matB, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 4) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> <changed_rows_or_columns> <rank>"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  int changed = atoi(argv[2]);
+  int rank = atoi(argv[3]);
+  if (size < 1 || changed < 1 || rank < 1) {
+    cout<<"the matrix size, change count and rank must be positive"<<endl;
+    return 1;
+  }
+  matIncremental(size, changed, rank);
+  return 0;
+}
@@ -0,0 +1,214 @@
+/**
+ * Parallel program to perform exact matrix-matrix multiplication modulo a prime p < 2^31
+ * with delayed reductions and AVX2 64 bit lane accumulators
+ *
+ * To run this program:
+ *  (compile): g++ -mavx2 -std=c++11 -fopenmp optimized_parallel_modular.cpp -o optimized_parallel_modular
+ *  (run): ./optimized_parallel_modular <matrix_size> [prime]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <stdint.h>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define S 64     //row / column tile size
+
+/*
+ * Constants for reducing 64 bit accumulators modulo p.
+ * A lane is folded as hi * (2^32 mod p) + lo, which keeps it congruent and below foldBound;
+ * batch is how many products of two residues can be added on top of that before the
+ * lane could overflow, i.e. how many multiply-adds are done between two folds.
+ */
+struct Modulus {
+  uint64_t p;
+  uint64_t r32;       //2^32 mod p
+  uint64_t barrett;   //floor(2^64 / p), for the final reduction
+  long batch;
+
+  Modulus(uint64_t prime) : p(prime) {
+    r32 = ((uint64_t)1 << 32) % p;
+    barrett = (uint64_t)(((unsigned __int128)1 << 64) / p);
+    uint64_t foldBound = 0xffffffffULL * r32 + 0xffffffffULL;
+    uint64_t headroom = (~(uint64_t)0 - foldBound) / ((p - 1) * (p - 1));
+    batch = (long)min(headroom, (uint64_t)1 << 40);
+  }
+
+  /*Barrett reduction of a full 64 bit value*/
+  uint32_t reduce(uint64_t x) const {
+    uint64_t q = (uint64_t)(((unsigned __int128)x * barrett) >> 64);
+    uint64_t r = x - q * p;
+    return (uint32_t)(r >= p ? r - p : r);
+  }
+};
+
+
+/*A method to initialize a matrix*/
+uint32_t** initMat(int size){
+  uint32_t** mat = new uint32_t*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new uint32_t[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(uint32_t** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to get the transpose matrix of a given matrix*/
+uint32_t** getTranspose(uint32_t** matrix, int size){
+  for (int row = 0; row < size; row++) {
+    for (int col = row+1; col < size; col++) {
+      std::swap(matrix[row][col], matrix[col][row]);
+    }
+  }
+  return matrix;
+}
+
+/*A method to populate a matrix with random residues modulo p*/
+void populateMat(uint32_t** matrix, int size, uint32_t p){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<uint32_t> dis(0, p - 1);
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*A method to fold the 4 64 bit lanes of acc to hi * (2^32 mod p) + lo*/
+inline __m256i fold(__m256i acc, __m256i r32){
+  __m256i lo = _mm256_and_si256(acc, _mm256_set1_epi64x(0xffffffffLL));
+  __m256i hi = _mm256_srli_epi64(acc, 32);
+  return _mm256_add_epi64(_mm256_mul_epu32(hi, r32), lo);
+}
+
+/*A method to load 4 residues and widen them to 64 bit lanes*/
+inline __m256i load4(const uint32_t* src){
+  return _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)src));
+}
+
+/*
+ * A method to perform C = A * B mod p. trans_matB holds B transposed. Every thread takes a
+ * row tile of C and computes 1x4 register tiles; each lane multiplies with vpmuludq and
+ * accumulates exactly in 64 bits, folding only every m.batch steps and reducing once at the end.
+ */
+double mod_mat_multiply(uint32_t **matA, uint32_t **trans_matB, uint32_t **matC, int size, const Modulus& m){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  int kEnd = size - size % 4;
+  __m256i r32 = _mm256_set1_epi64x((long long)m.r32);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int i0 = 0; i0 < size; i0 += S) {
+    for (int j0 = 0; j0 < size; j0 += S) {
+      for (int i = i0; i < min(size, i0 + S); i++) {
+        const uint32_t* a = matA[i];
+        for (int j = j0; j < min(size, j0 + S); j++) {
+          const uint32_t* b = trans_matB[j];
+          __m256i acc = _mm256_setzero_si256();
+          long pending = 0;
+          for (int k = 0; k < kEnd; k += 4) {
+            acc = _mm256_add_epi64(acc, _mm256_mul_epu32(load4(&a[k]), load4(&b[k])));
+            if (++pending == m.batch) {   //delayed reduction: fold only when the next product could overflow
+              acc = fold(acc, r32);
+              pending = 0;
+            }
+          }
+          uint64_t lanes[4];
+          _mm256_storeu_si256((__m256i*)lanes, fold(acc, r32));
+          uint64_t sum = 0;
+          for (int l = 0; l < 4; l++) sum += m.reduce(lanes[l]);
+          for (int k = kEnd; k < size; k++) sum += m.reduce((uint64_t)a[k] * b[k]);
+          matC[i][j] = m.reduce(sum);
+        }
+      }
+    }
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;   //Get duration in milli seconds
+}
+
+/*A method to perform C = A * B mod p reducing after every product, as the reference*/
+double naive_mod_multiply(uint32_t **matA, uint32_t **trans_matB, uint32_t **matC, int size, uint64_t p){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      uint64_t sum = 0;
+      for (int k = 0; k < size; k++) {
+        sum = (sum + (uint64_t)matA[i][k] * trans_matB[j][k]) % p;
+      }
+      matC[i][j] = (uint32_t)sum;
+    }
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;
+}
+
+/*A method that multiplies two random matrices modulo p and checks the result*/
+void matMultiply(int size, uint64_t p){
+  Modulus m(p);
+  uint32_t** matA = initMat(size);
+  uint32_t** matB = initMat(size);
+  uint32_t** matC = initMat(size);
+  uint32_t** matRef = initMat(size);
+  populateMat(matA, size, p);
+  populateMat(matB, size, p);
+
+  uint32_t** trans_matB = getTranspose(matB,size);
+
+  double duration = mod_mat_multiply(matA, trans_matB, matC, size, m);
+  double naive = naive_mod_multiply(matA, trans_matB, matRef, size, p);
+
+  long mismatches = 0;
+  for (int i = 0; i < size; i++)
+    for (int j = 0; j < size; j++)
+      mismatches += matC[i][j] != matRef[i][j];
+
+  cout<<"p = "<<p<<", products accumulated between folds = "<<m.batch<<endl;
+  cout<<"delayed reduction AVX2 multiply: "<<duration<<"ms"<<endl;
+  cout<<"reduce every product multiply:   "<<naive<<"ms"<<endl;
+  cout<<"mismatches = "<<mismatches<<endl;
+
+  freeMat(matA, size);
+  freeMat(matB, size);
+  freeMat(matC, size);
+  freeMat(matRef, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [prime]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  uint64_t p = argc > 2 ? strtoull(argv[2], NULL, 10) : 998244353;
+  if (p < 2 || p >= ((uint64_t)1 << 31)) {
+    cout<<"the modulus must be in [2, 2^31)"<<endl;
+    return 1;
+  }
+  matMultiply(size, p);
+  return 0;
+}
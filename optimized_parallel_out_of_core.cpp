@@ -0,0 +1,274 @@
+/**
+ * Parallel program to perform out-of-core matrix-matrix multiplication on matrices stored
+ * on disk in a tiled format, overlapping the read of the next panel with the compute of the current one
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp -pthread optimized_parallel_out_of_core.cpp -o optimized_parallel_out_of_core
+ *  (run): ./optimized_parallel_out_of_core <matrix_size> [tile_size] [memory_MB] [directory]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <future>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+/*
+ * A matrix on disk. After a header of HEADER_BYTES the matrix is stored as tiles x tiles
+ * square tiles of tile x tile doubles, tile by tile in row-major tile order, each tile row-major.
+ * Edge tiles are padded with zeros so every tile has the same size and offset arithmetic.
+ */
+#define HEADER_BYTES 4096
+#define MAGIC 0x454c4954584d4f43ULL   //"COMXTILE"
+
+struct TiledFile {
+  int fd;
+  int size;         //matrix dimension
+  int tile;         //tile dimension
+  int tiles;        //tiles per side
+  string path;
+
+  long tileBytes() const { return (long)tile * tile * sizeof(double); }
+  off_t offset(int ti, int tj) const { return HEADER_BYTES + ((off_t)ti * tiles + tj) * tileBytes(); }
+};
+
+/*Counters for the I/O done by the out of core multiply*/
+struct IOStats {
+  long bytesRead, bytesWritten;
+  double waitMs;    //time compute spent waiting for a read to finish
+};
+
+
+/*A method to read count bytes at offset, failing loudly on a short read*/
+void readFully(int fd, void* buf, long count, off_t offset){
+  char* p = (char*)buf;
+  while (count > 0) {
+    ssize_t n = pread(fd, p, count, offset);
+    if (n <= 0) { perror("pread"); exit(1); }
+    p += n; count -= n; offset += n;
+  }
+}
+
+/*A method to write count bytes at offset*/
+void writeFully(int fd, const void* buf, long count, off_t offset){
+  const char* p = (const char*)buf;
+  while (count > 0) {
+    ssize_t n = pwrite(fd, p, count, offset);
+    if (n <= 0) { perror("pwrite"); exit(1); }
+    p += n; count -= n; offset += n;
+  }
+}
+
+/*A method to create a tiled matrix file of the given size, with a header, all zero*/
+TiledFile createTiledFile(const string& path, int size, int tile){
+  TiledFile f;
+  f.path = path;
+  f.size = size;
+  f.tile = tile;
+  f.tiles = (size + tile - 1) / tile;
+  f.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (f.fd < 0) { perror(path.c_str()); exit(1); }
+  if (ftruncate(f.fd, f.offset(f.tiles, 0)) != 0) { perror("ftruncate"); exit(1); }
+
+  char header[HEADER_BYTES] = {0};
+  unsigned long long magic = MAGIC;
+  memcpy(header, &magic, 8);
+  memcpy(header + 8, &size, sizeof(int));
+  memcpy(header + 12, &tile, sizeof(int));
+  writeFully(f.fd, header, HEADER_BYTES, 0);
+  return f;
+}
+
+/*A method to close and delete a tiled matrix file*/
+void removeTiledFile(TiledFile& f){
+  close(f.fd);
+  unlink(f.path.c_str());
+}
+
+/*A method to populate a tiled matrix file with random values, one tile row at a time*/
+void populateTiledFile(TiledFile& f){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  vector<double> buf((long)f.tiles * f.tile * f.tile);
+  for (int ti = 0; ti < f.tiles; ti++) {
+    for (int tj = 0; tj < f.tiles; tj++) {
+      double* t = &buf[(long)tj * f.tile * f.tile];
+      for (int r = 0; r < f.tile; r++) {
+        for (int c = 0; c < f.tile; c++) {
+          bool inside = ti * f.tile + r < f.size && tj * f.tile + c < f.size;
+          t[r * f.tile + c] = inside ? dis(gen) : 0;
+        }
+      }
+    }
+    writeFully(f.fd, &buf[0], buf.size() * sizeof(double), f.offset(ti, 0));   //a tile row is contiguous
+  }
+}
+
+/*A method to load a whole tiled matrix file into an in-memory matrix (for checking)*/
+vector<double> loadTiledFile(const TiledFile& f){
+  vector<double> mat((long)f.size * f.size);
+  vector<double> t((long)f.tile * f.tile);
+  for (int ti = 0; ti < f.tiles; ti++) {
+    for (int tj = 0; tj < f.tiles; tj++) {
+      readFully(f.fd, &t[0], f.tileBytes(), f.offset(ti, tj));
+      for (int r = 0; r < f.tile && ti * f.tile + r < f.size; r++)
+        for (int c = 0; c < f.tile && tj * f.tile + c < f.size; c++)
+          mat[(long)(ti * f.tile + r) * f.size + tj * f.tile + c] = t[r * f.tile + c];
+    }
+  }
+  return mat;
+}
+
+/*
+ * A method to read panel k for the C block at tile rows [bi0, bi0+p) and tile columns
+ * [bj0, bj0+q): the p tiles A(bi, k) followed by the q tiles B(k, bj). Runs on an I/O thread.
+ */
+long readPanel(const TiledFile* fa, const TiledFile* fb, int bi0, int p, int bj0, int q, int k, double* buf){
+  long tileDoubles = (long)fa->tile * fa->tile;
+  for (int a = 0; a < p; a++) readFully(fa->fd, buf + a * tileDoubles, fa->tileBytes(), fa->offset(bi0 + a, k));
+  for (int b = 0; b < q; b++) readFully(fb->fd, buf + (p + b) * tileDoubles, fb->tileBytes(), fb->offset(k, bj0 + b));
+  return (p + q) * fa->tileBytes();
+}
+
+/*A method to perform the tile product C += A * B with 256 bit vectors (tile is a multiple of 4)*/
+inline void tileMultiply(const double* a, const double* b, double* c, int tile){
+  for (int i = 0; i < tile; i++) {
+    double* ci = c + i * tile;
+    for (int k = 0; k < tile; k++) {
+      __m256d va = _mm256_set1_pd(a[i * tile + k]);
+      const double* bk = b + k * tile;
+      for (int j = 0; j < tile; j += 4) {
+        _mm256_storeu_pd(&ci[j], _mm256_add_pd(_mm256_loadu_pd(&ci[j]), _mm256_mul_pd(va, _mm256_loadu_pd(&bk[j]))));
+      }
+    }
+  }
+}
+
+/*
+ * A method to perform C = A * B on tiled files using at most memoryBytes of buffers.
+ *
+ * C is produced one block of p x q tiles at a time, kept in memory until complete and
+ * written once. For a block, the k panels (p tiles of A, q tiles of B) are streamed with
+ * two buffers: while the tiles of panel k are multiplied by all threads, panel k+1 is read
+ * by an asynchronous I/O thread. A is then read tiles/q times and B tiles/p times, so the
+ * largest square block that fits (p*q + 2*(p+q) tiles) minimises the total bytes read.
+ */
+IOStats out_of_core_multiply(const TiledFile& fa, const TiledFile& fb, TiledFile& fc, long memoryBytes){
+  IOStats stats = { 0, 0, 0 };
+  int tiles = fa.tiles;
+  long tileDoubles = (long)fa.tile * fa.tile;
+  long budget = memoryBytes / fa.tileBytes();
+
+  int p = 1;
+  while (p < tiles && (long)(p+1) * (p+1) + 4 * (p+1) <= budget) p++;
+  int q = p;
+  cout<<"C block = "<<p<<"x"<<q<<" tiles of "<<fa.tile<<"x"<<fa.tile<<", buffers = "
+      <<((long)p*q + 2*(p+q)) * fa.tileBytes() / (1 << 20)<<" MB"<<endl;
+
+  vector<double> cBlock((long)p * q * tileDoubles);
+  vector<double> panels[2];
+  panels[0].resize((long)(p + q) * tileDoubles);
+  panels[1].resize((long)(p + q) * tileDoubles);
+
+  for (int bi0 = 0; bi0 < tiles; bi0 += p) {
+    for (int bj0 = 0; bj0 < tiles; bj0 += q) {
+      int pb = min(p, tiles - bi0), qb = min(q, tiles - bj0);
+      std::fill(cBlock.begin(), cBlock.end(), 0.0);
+
+      future<long> pending = async(launch::async, readPanel, &fa, &fb, bi0, pb, bj0, qb, 0, &panels[0][0]);
+      for (int k = 0; k < tiles; k++) {
+        high_resolution_clock::time_point waitStart = high_resolution_clock::now();
+        stats.bytesRead += pending.get();
+        stats.waitMs += (double)duration_cast<nanoseconds>( high_resolution_clock::now() - waitStart ).count()/1000000;
+
+        if (k + 1 < tiles)    //start reading the next panel into the other buffer before computing on this one
+          pending = async(launch::async, readPanel, &fa, &fb, bi0, pb, bj0, qb, k + 1, &panels[(k + 1) % 2][0]);
+
+        const double* panel = &panels[k % 2][0];
+        #pragma omp parallel for collapse(2) schedule(dynamic)
+        for (int a = 0; a < pb; a++) {
+          for (int b = 0; b < qb; b++) {
+            tileMultiply(panel + a * tileDoubles, panel + (pb + b) * tileDoubles, &cBlock[(a * q + b) * tileDoubles], fa.tile);
+          }
+        }
+      }
+
+      for (int a = 0; a < pb; a++) {
+        for (int b = 0; b < qb; b++) {
+          writeFully(fc.fd, &cBlock[(a * q + b) * tileDoubles], fc.tileBytes(), fc.offset(bi0 + a, bj0 + b));
+          stats.bytesWritten += fc.tileBytes();
+        }
+      }
+    }
+  }
+  return stats;
+}
+
+/*A method that creates random A and B files, multiplies them out of core and reports the I/O*/
+void matMultiply(int size, int tile, long memoryBytes, const string& dir){
+  TiledFile fa = createTiledFile(dir + "/ooc_A.tiled", size, tile);
+  TiledFile fb = createTiledFile(dir + "/ooc_B.tiled", size, tile);
+  TiledFile fc = createTiledFile(dir + "/ooc_C.tiled", size, tile);
+  populateTiledFile(fa);
+  populateTiledFile(fb);
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  IOStats stats = out_of_core_multiply(fa, fb, fc, memoryBytes);
+  double duration = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  double matrixMB = (double)fa.offset(fa.tiles, 0) / (1 << 20);
+  cout<<"out of core multiply: "<<duration<<"ms, compute waited "<<stats.waitMs<<"ms for reads"<<endl;
+  cout<<"read "<<(double)stats.bytesRead / (1 << 20)<<" MB ("<<stats.bytesRead / (double)(2 * (fa.offset(fa.tiles, 0) - HEADER_BYTES))
+      <<" x the size of A and B, "<<matrixMB<<" MB each), wrote "<<(double)stats.bytesWritten / (1 << 20)<<" MB"<<endl;
+
+  if (size <= 1500) {   //load everything and compare with an in memory multiply
+    vector<double> a = loadTiledFile(fa), b = loadTiledFile(fb), c = loadTiledFile(fc);
+    double maxDiff = 0;
+    #pragma omp parallel for reduction(max:maxDiff)
+    for (int i = 0; i < size; i++) {
+      vector<double> row(size, 0.0);
+      for (int k = 0; k < size; k++)
+        for (int j = 0; j < size; j++) row[j] += a[(long)i * size + k] * b[(long)k * size + j];
+      for (int j = 0; j < size; j++) maxDiff = max(maxDiff, fabs(row[j] - c[(long)i * size + j]) / row[j]);
+    }
+    cout<<"max relative difference = "<<maxDiff<<endl;
+  }
+
+  removeTiledFile(fa);
+  removeTiledFile(fb);
+  removeTiledFile(fc);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [tile_size] [memory_MB] [directory]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  int tile = argc > 2 ? atoi(argv[2]) : 256;
+  long memoryBytes = (argc > 3 ? atol(argv[3]) : 64) << 20;
+  string dir = argc > 4 ? argv[4] : "/tmp";
+  tile = (tile + 3) / 4 * 4;    //tile rows must be whole 256 bit vectors
+  if (memoryBytes < 5 * (long)tile * tile * (long)sizeof(double)) {
+    cout<<"the memory budget must hold at least 5 tiles"<<endl;
+    return 1;
+  }
+  matMultiply(size, tile, memoryBytes, dir);
+  return 0;
+}
@@ -0,0 +1,219 @@
+/**
+ * Parallel program to compute the matrix power A^k by repeated squaring, ping-ponging
+ * between two preallocated buffers and packing the base matrix only once
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_power.cpp -o optimized_parallel_power
+ *  (run): ./optimized_parallel_power <matrix_size> <power>
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+
+/*A method to initialize a matrix*/
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to populate a matrix with a random transition matrix (non negative rows that sum to 1)*/
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < size; row++) {
+    double sum = 0;
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+      sum += matrix[row][col];
+    }
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] /= sum;
+    }
+  }
+}
+
+/*
+ * A method to pack B for use as the right operand: column j of B is stored contiguously
+ * at packed[j*size]. Unlike getTranspose this leaves B untouched.
+ */
+void packB(double** matB, double* packed, int size){
+  #pragma omp parallel for
+  for (int j = 0; j < size; j++) {
+    for (int k = 0; k < size; k++) {
+      packed[(long)j * size + k] = matB[k][j];
+    }
+  }
+}
+
+/*A method to sum the 4 lanes of each of c0..c3 into one vector {sum(c0), sum(c1), sum(c2), sum(c3)}*/
+inline __m256d reduce4(__m256d c0, __m256d c1, __m256d c2, __m256d c3){
+  __m256d t0 = _mm256_hadd_pd(c0, c1);
+  __m256d t1 = _mm256_hadd_pd(c2, c3);
+  return _mm256_add_pd(_mm256_permute2f128_pd(t0, t1, 0x20), _mm256_permute2f128_pd(t0, t1, 0x31));
+}
+
+/*A method to perform C = A * B where packedB is B packed by packB; C must not alias A*/
+void mat_multiply_packed(double **matA, const double *packedB, double **matC, int size){
+  int kEnd = size - size % 4;
+
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    const double* a = matA[i];
+    int j = 0;
+    for (; j + 4 <= size; j += 4) {
+      const double* b0 = packedB + (long)j * size;
+      const double* b1 = b0 + size;
+      const double* b2 = b1 + size;
+      const double* b3 = b2 + size;
+      __m256d c0 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd();
+      __m256d c2 = _mm256_setzero_pd(), c3 = _mm256_setzero_pd();
+      for (int k = 0; k < kEnd; k += 4) {
+        __m256d va = _mm256_loadu_pd(&a[k]);
+        c0 = _mm256_add_pd(c0, _mm256_mul_pd(va, _mm256_loadu_pd(&b0[k])));
+        c1 = _mm256_add_pd(c1, _mm256_mul_pd(va, _mm256_loadu_pd(&b1[k])));
+        c2 = _mm256_add_pd(c2, _mm256_mul_pd(va, _mm256_loadu_pd(&b2[k])));
+        c3 = _mm256_add_pd(c3, _mm256_mul_pd(va, _mm256_loadu_pd(&b3[k])));
+      }
+      double tile[4];
+      _mm256_storeu_pd(tile, reduce4(c0, c1, c2, c3));
+      for (int k = kEnd; k < size; k++) {
+        tile[0] += a[k]*b0[k]; tile[1] += a[k]*b1[k];
+        tile[2] += a[k]*b2[k]; tile[3] += a[k]*b3[k];
+      }
+      for (int t = 0; t < 4; t++) matC[i][j+t] = tile[t];
+    }
+    for (; j < size; j++) {
+      const double* b = packedB + (long)j * size;
+      double sum = 0;
+      for (int k = 0; k < size; k++) sum += a[k]*b[k];
+      matC[i][j] = sum;
+    }
+  }
+}
+
+/*
+ * A method to compute A^power (power >= 1) into matC with left-to-right binary exponentiation:
+ * for every bit of the exponent after the leading one, square, then multiply by A if the bit
+ * is set. The right operand of every "multiply by A" is the same, so A is packed once; the
+ * running result ping-pongs between matC and one scratch buffer. Returns the number of multiplies.
+ */
+int mat_power(double **matA, double **matC, int size, long power){
+  double** scratch = initMat(size);
+  double* packedA = new double[(long)size * size];
+  double* packedR = new double[(long)size * size];
+  packB(matA, packedA, size);
+
+  int top = 63 - __builtin_clzll(power);
+  int multiplies = 0;
+
+  //count the multiplies up front and start in the buffer that makes the last one land in matC
+  int steps = 0;
+  for (int b = top - 1; b >= 0; b--) steps += 1 + ((power >> b) & 1);
+  double** cur = (steps % 2 == 0) ? matC : scratch;
+  double** other = (cur == matC) ? scratch : matC;
+
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) cur[i][j] = matA[i][j];
+  }
+
+  for (int b = top - 1; b >= 0; b--) {
+    packB(cur, packedR, size);
+    mat_multiply_packed(cur, packedR, other, size);     //square
+    std::swap(cur, other);
+    multiplies++;
+    if ((power >> b) & 1) {
+      mat_multiply_packed(cur, packedA, other, size);   //multiply by the base, already packed
+      std::swap(cur, other);
+      multiplies++;
+    }
+  }
+
+  freeMat(scratch, size);
+  delete[] packedA;
+  delete[] packedR;
+  return multiplies;
+}
+
+/*A method that raises a random transition matrix to the given power and compares with repeated multiplication*/
+void matPower(int size, long power){
+  double** matA = initMat(size);
+  double** matC = initMat(size);
+  populateMat(matA, size);
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  int multiplies = mat_power(matA, matC, size, power);
+  double duration = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  cout<<"A^"<<power<<" by repeated squaring: "<<duration<<"ms, "<<multiplies<<" multiplies"<<endl;
+
+  if (power <= 256) {   //power-1 separate multiplies, each allocating its result, as the reference
+    double* packedA = new double[(long)size * size];
+    packB(matA, packedA, size);
+    double** ref = initMat(size);
+    for (int i = 0; i < size; i++)
+      for (int j = 0; j < size; j++) ref[i][j] = matA[i][j];
+
+    start = high_resolution_clock::now();
+    for (long p = 1; p < power; p++) {
+      double** next = initMat(size);
+      mat_multiply_packed(ref, packedA, next, size);
+      freeMat(ref, size);
+      ref = next;
+    }
+    double naive = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+    double maxDiff = 0;
+    for (int i = 0; i < size; i++)
+      for (int j = 0; j < size; j++)
+        maxDiff = max(maxDiff, fabs(ref[i][j] - matC[i][j]));
+    cout<<"A^"<<power<<" by "<<power-1<<" multiplies:       "<<naive<<"ms"<<endl;
+    cout<<"max difference = "<<maxDiff<<endl;
+
+    freeMat(ref, size);
+    delete[] packedA;
+  }
+
+  freeMat(matA, size);
+  freeMat(matC, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 3) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> <power>"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  long power = atol(argv[2]);
+  if (power < 1) {
+    cout<<"the power must be at least 1"<<endl;
+    return 1;
+  }
+  matPower(size, power);
+  return 0;
+}
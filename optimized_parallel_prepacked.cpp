@@ -0,0 +1,237 @@
+/**
+ * Parallel program to multiply a stream of different A matrices by the same B, packing B once
+ * into a reusable handle instead of transposing it on every call
+ *
+ * The handle stores B in the kernel's panel format: k blocks of KC rows, each split into panels
+ * of 4 columns stored contiguously, so the kernel streams B with unit stride and a pair of
+ * panels stays in L1 while a block of A rows is swept across it. B itself is never modified.
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_prepacked.cpp -o optimized_parallel_prepacked
+ *  (run): ./optimized_parallel_prepacked <matrix_size> <number_of_A_matrices>
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define KC 256      //rows of B in a k block
+#define MC 64       //rows of A swept across one pair of panels
+
+/*
+ * B packed for mat_multiply_prepacked. The panel of columns 4g..4g+3 in the k block starting
+ * at k0 (kLen rows long) starts at data + k0 * panels * 4 + g * kLen * 4 and holds kLen rows of
+ * 4 values. panels is even and the columns past size are zero.
+ */
+struct PackedB {
+  int size, panels;
+  double* data;
+};
+
+
+/*A method to initialize a matrix*/
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+double** getTranspose(double** matrix, int size){
+  for (int row = 0; row < size; row++) {
+    for (int col = row+1; col < size; col++) {
+      std::swap(matrix[row][col], matrix[col][row]);
+    }
+  }
+  return matrix;
+}
+
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*A method to pack B into a handle that any number of later multiplies can share; B is only read*/
+PackedB* packB(double** matB, int size){
+  PackedB* packed = new PackedB();
+  packed->size = size;
+  packed->panels = ((size + 3) / 4 + 1) / 2 * 2;
+  packed->data = (double*)_mm_malloc((long)size * packed->panels * 4 * sizeof(double), 32);
+
+  #pragma omp parallel for collapse(2)
+  for (int k0 = 0; k0 < size; k0 += KC) {
+    for (int g = 0; g < packed->panels; g++) {
+      int kLen = min(KC, size - k0);
+      double* panel = packed->data + (long)k0 * packed->panels * 4 + (long)g * kLen * 4;
+      for (int k = 0; k < kLen; k++)
+        for (int c = 0; c < 4; c++)
+          panel[k * 4 + c] = (4 * g + c < size) ? matB[k0 + k][4 * g + c] : 0;
+    }
+  }
+  return packed;
+}
+
+void freePackedB(PackedB* packed){
+  _mm_free(packed->data);
+  delete packed;
+}
+
+/*
+ * A method to add rows x 8 of A(rows, k block) * B(k block, two panels) to C at column j, for
+ * rows = 1 or 2. The accumulators start from C, so the k blocks sum up in place.
+ */
+inline void microKernel(double** matA, double** matC, int i, int rows, int k0, int kLen,
+                        const double* p0, const double* p1, int j, int size){
+  double tile[2][8];
+  for (int r = 0; r < rows; r++)
+    for (int c = 0; c < 8; c++) tile[r][c] = (j + c < size) ? matC[i+r][j+c] : 0;
+
+  __m256d c00 = _mm256_loadu_pd(&tile[0][0]), c01 = _mm256_loadu_pd(&tile[0][4]);
+  __m256d c10 = _mm256_loadu_pd(&tile[1][0]), c11 = _mm256_loadu_pd(&tile[1][4]);
+  const double* a0 = matA[i] + k0;
+  const double* a1 = matA[i + rows - 1] + k0;
+  for (int k = 0; k < kLen; k++) {
+    __m256d b0 = _mm256_load_pd(&p0[k * 4]), b1 = _mm256_load_pd(&p1[k * 4]);
+    __m256d va = _mm256_set1_pd(a0[k]);
+    c00 = _mm256_add_pd(c00, _mm256_mul_pd(va, b0));
+    c01 = _mm256_add_pd(c01, _mm256_mul_pd(va, b1));
+    va = _mm256_set1_pd(a1[k]);
+    c10 = _mm256_add_pd(c10, _mm256_mul_pd(va, b0));
+    c11 = _mm256_add_pd(c11, _mm256_mul_pd(va, b1));
+  }
+  _mm256_storeu_pd(&tile[0][0], c00); _mm256_storeu_pd(&tile[0][4], c01);
+  _mm256_storeu_pd(&tile[1][0], c10); _mm256_storeu_pd(&tile[1][4], c11);
+
+  for (int r = 0; r < rows; r++)
+    for (int c = 0; c < 8 && j + c < size; c++) matC[i+r][j+c] = tile[r][c];
+}
+
+/*A method to perform C = A * B with B given as a handle from packB; no preparation of B at all*/
+void mat_multiply_prepacked(double** matA, const PackedB& packed, double** matC, int size){
+  int panels = packed.panels;
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int i0 = 0; i0 < size; i0 += MC) {
+    int iEnd = min(i0 + MC, size);
+    for (int i = i0; i < iEnd; i++)
+      for (int j = 0; j < size; j++) matC[i][j] = 0;
+
+    for (int k0 = 0; k0 < size; k0 += KC) {
+      int kLen = min(KC, size - k0);
+      const double* block = packed.data + (long)k0 * panels * 4;
+      for (int g = 0; g < panels; g += 2) {
+        const double* p0 = block + (long)g * kLen * 4;
+        const double* p1 = p0 + kLen * 4;
+        for (int i = i0; i < iEnd; i += 2)
+          microKernel(matA, matC, i, min(2, iEnd - i), k0, kLen, p0, p1, 4 * g, size);
+      }
+    }
+  }
+}
+
+/*
+ * The per-call path this replaces: transpose B in place, run the dot product kernel of
+ * optimized_parallel_avx.cpp, and transpose B back so the caller gets its B again.
+ */
+void mat_multiply_transposing(double** matA, double** matB, double** matC, int size){
+  double** trans_matB = getTranspose(matB, size);
+  int kEnd = size - size % 4;
+
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      __m256d c = _mm256_setzero_pd();
+      double tempresult[4];
+      for (int k = 0; k < kEnd; k += 4) {
+        c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&matA[i][k]), _mm256_loadu_pd(&trans_matB[j][k])));
+      }
+      _mm256_storeu_pd(tempresult, c);
+      double sum = tempresult[0]+tempresult[1]+tempresult[2]+tempresult[3];
+      for (int k = kEnd; k < size; k++) sum += matA[i][k] * trans_matB[j][k];
+      matC[i][j] = sum;
+    }
+  }
+
+  getTranspose(matB, size);
+}
+
+/*A method that multiplies count random A matrices by one B, per call transposing and with one packed handle*/
+void matMultiply(int size, int count){
+  double** matB = initMat(size);
+  double** matC = initMat(size);
+  double** ref = initMat(size);
+  populateMat(matB, size);
+  vector<double**> matAs(count);
+  for (int a = 0; a < count; a++) {
+    matAs[a] = initMat(size);
+    populateMat(matAs[a], size);
+  }
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  for (int a = 0; a < count; a++) mat_multiply_transposing(matAs[a], matB, ref, size);
+  double transposing = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  start = high_resolution_clock::now();
+  PackedB* packed = packB(matB, size);
+  double packing = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  for (int a = 0; a < count; a++) mat_multiply_prepacked(matAs[a], *packed, matC, size);
+  double prepacked = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  double maxDiff = 0;   //both results are for the last A
+  for (int i = 0; i < size; i++)
+    for (int j = 0; j < size; j++)
+      maxDiff = max(maxDiff, fabs(ref[i][j] - matC[i][j]) / ref[i][j]);
+
+  cout<<count<<" multiplies of "<<size<<"x"<<size<<" by the same B"<<endl;
+  cout<<"transposing B on every call: "<<transposing<<"ms"<<endl;
+  cout<<"packed handle:               "<<prepacked<<"ms (of which packing once "<<packing<<"ms)"<<endl;
+  cout<<"max relative difference = "<<maxDiff<<endl;
+
+  freePackedB(packed);
+  for (int a = 0; a < count; a++) freeMat(matAs[a], size);
+  freeMat(matB, size);
+  freeMat(matC, size);
+  freeMat(ref, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 3) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> <number_of_A_matrices>"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  int count = atoi(argv[2]);
+  if (size < 1 || count < 1) {
+    cout<<"the matrix size and the number of A matrices must be positive"<<endl;
+    return 1;
+  }
+  matMultiply(size, count);
+  return 0;
+}
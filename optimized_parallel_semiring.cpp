@@ -0,0 +1,252 @@
+/**
+ * Parallel program to perform tiled matrix-matrix multiplication over a generic semiring
+ * (plus-times, min-plus, max-plus, max-times), with all-pairs shortest paths as an example
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_semiring.cpp -o optimized_parallel_semiring
+ *  (run): ./optimized_parallel_semiring <matrix_size>
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define S 64     //tile size, multiple of 4 so tile rows are whole 256 bit vectors
+
+
+/*
+ * Semirings. zero() is the identity of add (and absorbing for mul); the kernel
+ * computes C[i][j] = add over k of mul(A[i][k], B[k][j]).
+ */
+
+/*Ordinary arithmetic*/
+struct PlusTimes {
+  static const char* name() { return "plus-times"; }
+  static double zero() { return 0; }
+  static double add(double a, double b) { return a + b; }
+  static double mul(double a, double b) { return a * b; }
+  static __m256d add(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+  static __m256d mul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+};
+
+/*Tropical semiring used for shortest paths*/
+struct MinPlus {
+  static const char* name() { return "min-plus"; }
+  static double zero() { return numeric_limits<double>::infinity(); }
+  static double add(double a, double b) { return a < b ? a : b; }
+  static double mul(double a, double b) { return a + b; }
+  static __m256d add(__m256d a, __m256d b) { return _mm256_min_pd(a, b); }
+  static __m256d mul(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+};
+
+/*Used for longest paths and Viterbi scoring in log space*/
+struct MaxPlus {
+  static const char* name() { return "max-plus"; }
+  static double zero() { return -numeric_limits<double>::infinity(); }
+  static double add(double a, double b) { return a > b ? a : b; }
+  static double mul(double a, double b) { return a + b; }
+  static __m256d add(__m256d a, __m256d b) { return _mm256_max_pd(a, b); }
+  static __m256d mul(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+};
+
+/*Used for Viterbi scoring with probabilities (non negative values)*/
+struct MaxTimes {
+  static const char* name() { return "max-times"; }
+  static double zero() { return 0; }
+  static double add(double a, double b) { return a > b ? a : b; }
+  static double mul(double a, double b) { return a * b; }
+  static __m256d add(__m256d a, __m256d b) { return _mm256_max_pd(a, b); }
+  static __m256d mul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+};
+
+
+/*A method to initialize a matrix*/
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to populate a matrix with random values*/
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*
+ * A method to perform C = A (x) B over the semiring SR with S x S tiles.
+ * Row tiles of C are shared among the threads; inside a tile A[i][k] is broadcast and
+ * combined with 4 consecutive elements of row k of B, so no transpose or horizontal
+ * reduction is needed and min/max semirings vectorise the same way as plus-times.
+ */
+template <typename SR>
+double semiring_mat_multiply(double **matA, double **matB, double **matC, int size){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < size; i += S) {
+    int iEnd = min(size, i + S);
+    for (int ii = i; ii < iEnd; ii++)
+      for (int j = 0; j < size; j++) matC[ii][j] = SR::zero();
+
+    for (int k = 0; k < size; k += S) {
+      int kEnd = min(size, k + S);
+      for (int j = 0; j < size; j += S) {
+        int jEnd = min(size, j + S);
+        int jVec = j + (jEnd - j) / 4 * 4;
+        for (int ii = i; ii < iEnd; ii++) {
+          double* c = matC[ii];
+          for (int kk = k; kk < kEnd; kk++) {
+            double a = matA[ii][kk];
+            const double* b = matB[kk];
+            __m256d va = _mm256_set1_pd(a);
+            for (int jj = j; jj < jVec; jj += 4) {
+              _mm256_storeu_pd(&c[jj], SR::add(_mm256_loadu_pd(&c[jj]), SR::mul(va, _mm256_loadu_pd(&b[jj]))));
+            }
+            for (int jj = jVec; jj < jEnd; jj++) {
+              c[jj] = SR::add(c[jj], SR::mul(a, b[jj]));
+            }
+          }
+        }
+      }
+    }
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;   //Get duration in milli seconds
+}
+
+/*A method to perform the semiring product with the naive triple loop, as the reference*/
+template <typename SR>
+void naive_multiply(double **matA, double **matB, double **matC, int size){
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      double c = SR::zero();
+      for (int k = 0; k < size; k++) {
+        c = SR::add(c, SR::mul(matA[i][k], matB[k][j]));
+      }
+      matC[i][j] = c;
+    }
+  }
+}
+
+/*A method to get the largest relative difference between two matrices*/
+double maxRelDiff(double **matA, double **matB, int size){
+  double maxDiff = 0;
+  for (int i = 0; i < size; i++)
+    for (int j = 0; j < size; j++)
+      if (matA[i][j] != matB[i][j])
+        maxDiff = max(maxDiff, fabs(matA[i][j] - matB[i][j]) / max(fabs(matA[i][j]), 1.0));
+  return maxDiff;
+}
+
+/*A method that multiplies two random matrices over the semiring SR and checks the result*/
+template <typename SR>
+void runSemiring(double **matA, double **matB, int size){
+  double** matC = initMat(size);
+  double** matRef = initMat(size);
+
+  double duration = semiring_mat_multiply<SR>(matA, matB, matC, size);
+  naive_multiply<SR>(matA, matB, matRef, size);
+  cout<<SR::name()<<": "<<duration<<"ms, max relative difference = "<<maxRelDiff(matC, matRef, size)<<endl;
+
+  freeMat(matC, size);
+  freeMat(matRef, size);
+}
+
+/*
+ * A method to compute all-pairs shortest paths of a random weighted graph by squaring its
+ * distance matrix over min-plus ceil(log2(n-1)) times, checked against Floyd-Warshall.
+ */
+void shortestPaths(int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> weight(1,10);
+  std::uniform_real_distribution<> keep(0,1);
+
+  double** dist = initMat(size);
+  double** tmp = initMat(size);
+  double** ref = initMat(size);
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      dist[i][j] = i == j ? 0 : (keep(gen) < 4.0 / size ? weight(gen) : MinPlus::zero());
+      ref[i][j] = dist[i][j];
+    }
+  }
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();
+  int squarings = 0;
+  for (int hops = 1; hops < size - 1; hops *= 2) {    //after the squaring, paths of up to 2*hops edges are covered
+    semiring_mat_multiply<MinPlus>(dist, dist, tmp, size);
+    std::swap(dist, tmp);
+    squarings++;
+  }
+  double duration = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  for (int k = 0; k < size; k++) {
+    #pragma omp parallel for
+    for (int i = 0; i < size; i++)
+      for (int j = 0; j < size; j++)
+        ref[i][j] = min(ref[i][j], ref[i][k] + ref[k][j]);
+  }
+
+  cout<<"all-pairs shortest paths: "<<squarings<<" min-plus squarings, "<<duration<<"ms, max relative difference to Floyd-Warshall = "
+      <<maxRelDiff(dist, ref, size)<<endl;
+
+  freeMat(dist, size);
+  freeMat(tmp, size);
+  freeMat(ref, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size>"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+
+  double** matA = initMat(size);
+  double** matB = initMat(size);
+  populateMat(matA , size);
+  populateMat(matB, size);
+
+  runSemiring<PlusTimes>(matA, matB, size);
+  runSemiring<MinPlus>(matA, matB, size);
+  runSemiring<MaxPlus>(matA, matB, size);
+  runSemiring<MaxTimes>(matA, matB, size);
+  shortestPaths(size);
+
+  freeMat(matA, size);
+  freeMat(matB, size);
+  return 0;
+}
@@ -0,0 +1,608 @@
+/**
+ * Parallel program running a long-lived multiply daemon on a Unix-domain socket
+ *
+ * Clients put A and B in a POSIX shared memory object and send its name with the dimensions;
+ * the daemon multiplies into the C area of the same object and replies with its queueing and
+ * compute times. The OpenMP team, the packing buffers and the mappings of a connection stay
+ * warm between requests, and small requests arriving close together are run as one batch:
+ * a single parallel loop over the row blocks of all of them.
+ *
+ * Object layout: A (m x k), then B (k x n), then C (m x n), row-major doubles.
+ *
+ * The daemon works on the client's object in place, without a copy, and so trusts its clients:
+ * the object must keep its size until the reply arrives. A client that shrinks it with
+ * ftruncate while its request runs makes the daemon take SIGBUS, which ends it for every
+ * client. Run it for clients under the same administration, not as a shared service.
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp -pthread optimized_parallel_server.cpp -o optimized_parallel_server -lrt
+ *  (run): ./optimized_parallel_server serve <socket_path> [batch_window_us]
+ *         ./optimized_parallel_server client <socket_path> <size> <requests> [client_threads]
+ *         ./optimized_parallel_server stop <socket_path>
+ *         ./optimized_parallel_server demo <size> <requests> [client_threads]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define OP_MULTIPLY 1
+#define OP_SHUTDOWN 2
+
+#define SMALL_MULTIPLY (128L * 128 * 128)   //multiply-adds up to which a request waits to be batched
+#define MAX_BATCH 64
+#define BLOCK_ROWS 8                        //rows of C per work item of a batch
+
+/*A request on the socket*/
+struct Request {
+  uint32_t op;
+  uint32_t m, k, n;
+  uint64_t id;
+  char shm[64];           //name of the shared memory object holding A, B and C
+};
+
+/*The reply to one multiply request; status 0 on success, else an errno value*/
+struct Response {
+  uint64_t id;
+  int32_t status;
+  uint32_t batch;         //requests in the batch this one ran in
+  double queueUs;         //from arrival at the daemon to the start of its batch
+  double computeUs;       //duration of its batch
+};
+
+
+/*A method to read exactly count bytes; returns false if the stream ends first*/
+bool readFully(int fd, void* buf, size_t count){
+  char* p = (char*)buf;
+  while (count > 0) {
+    ssize_t n = read(fd, p, count);
+    if (n <= 0) return false;
+    p += n; count -= n;
+  }
+  return true;
+}
+
+/*A method to write count bytes; returns false if the peer has gone*/
+bool writeFully(int fd, const void* buf, size_t count){
+  const char* p = (const char*)buf;
+  while (count > 0) {
+    ssize_t n = write(fd, p, count);
+    if (n <= 0) return false;
+    p += n; count -= n;
+  }
+  return true;
+}
+
+sockaddr_un address(const string& path){
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+/*
+ * A method to compute the bytes of an object holding A, B and C; returns false if a dimension
+ * is not in [1, INT_MAX] or the size does not fit in a size_t
+ */
+bool objectBytes(uint64_t m, uint64_t k, uint64_t n, size_t& bytes){
+  if (m < 1 || k < 1 || n < 1 || m > INT_MAX || k > INT_MAX || n > INT_MAX) return false;
+  uint64_t elements = m * k + k * n + m * n;      //each product < 2^62, so the sum cannot wrap
+  if (elements > SIZE_MAX / sizeof(double)) return false;
+  bytes = elements * sizeof(double);
+  return true;
+}
+
+
+/*A client's shared memory object, mapped into the daemon*/
+struct Mapping {
+  string name;
+  dev_t dev;              //identity of the object, in case the name is unlinked and reused
+  ino_t ino;
+  void* base;
+  size_t bytes;
+
+  ~Mapping(){ if (base != MAP_FAILED) munmap(base, bytes); }
+};
+
+/*
+ * One client connection. The reader thread keeps the last mapping, so a client reusing its
+ * object pays for mmap once; replies come from the compute thread, and from the
+ * reader for rejected requests, so writes are serialised.
+ */
+struct Connection {
+  int fd;
+  mutex writeLock;
+  shared_ptr<Mapping> mapping;
+
+  explicit Connection(int f) : fd(f) {}
+  ~Connection(){ close(fd); }
+
+  void reply(const Response& r){
+    lock_guard<mutex> guard(writeLock);
+    writeFully(fd, &r, sizeof(r));
+  }
+};
+
+/*A multiply waiting for, or running in, a batch*/
+struct Job {
+  shared_ptr<Connection> conn;
+  shared_ptr<Mapping> mapping;
+  Request req;
+  high_resolution_clock::time_point arrived;
+  double *a, *b, *c, *packed;
+
+  long work() const { return (long)req.m * req.k * req.n; }
+};
+
+/*
+ * The queue between the connection readers and the compute thread. takeBatch() returns one
+ * large job on its own, or up to MAX_BATCH small ones, waiting at most window after the first
+ * small one for others to join it.
+ */
+struct JobQueue {
+  deque<Job*> items;
+  mutex lock;
+  condition_variable ready;
+  bool stopping = false;
+  microseconds window;
+
+  explicit JobQueue(microseconds w) : window(w) {}
+
+  /*Returns false, leaving the job to the caller, once the queue has been stopped*/
+  bool push(Job* job){
+    lock_guard<mutex> guard(lock);
+    if (stopping) return false;
+    items.push_back(job);
+    ready.notify_one();
+    return true;
+  }
+
+  void stop(){
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+    ready.notify_all();
+  }
+
+  /*Returns an empty batch once stopped and drained*/
+  vector<Job*> takeBatch(){
+    vector<Job*> batch;
+    unique_lock<mutex> guard(lock);
+    ready.wait(guard, [this] { return stopping || !items.empty(); });
+    if (items.empty()) return batch;
+
+    batch.push_back(items.front());
+    items.pop_front();
+    if (batch[0]->work() > SMALL_MULTIPLY) return batch;
+
+    high_resolution_clock::time_point deadline = batch[0]->arrived + window;
+    while (batch.size() < MAX_BATCH) {
+      if (!items.empty()) {
+        if (items.front()->work() > SMALL_MULTIPLY) break;
+        batch.push_back(items.front());
+        items.pop_front();
+      }
+      else if (stopping || ready.wait_until(guard, deadline) == cv_status::timeout) break;
+    }
+    return batch;
+  }
+};
+
+/*
+ * Packing buffers kept between batches, handed out best fit. Only the compute thread uses it,
+ * so unlike the pool of optimized_parallel_chain.cpp it needs no lock.
+ */
+struct BufferPool {
+  vector<pair<long, double*> > free;
+  int allocations = 0, reuses = 0;
+
+  ~BufferPool(){ for (size_t b = 0; b < free.size(); b++) delete[] free[b].second; }
+
+  double* acquire(long need, long& capacity){
+    int best = -1;
+    for (size_t b = 0; b < free.size(); b++)
+      if (free[b].first >= need && (best < 0 || free[b].first < free[best].first)) best = b;
+    if (best < 0) {
+      allocations++;
+      capacity = need;
+      return new double[need];
+    }
+    reuses++;
+    double* data = free[best].second;
+    capacity = free[best].first;
+    free.erase(free.begin() + best);
+    return data;
+  }
+
+  void release(double* data, long capacity){
+    free.push_back(make_pair(capacity, data));
+  }
+};
+
+
+/*
+ * A method to pack column panel g of B (k x n): B[kk][4g..4g+3] for every kk, contiguously,
+ * zero padded past n
+ */
+void packPanel(const double* b, double* packed, int k, int n, int g){
+  double* out = packed + (long)g * k * 4;
+  for (int kk = 0; kk < k; kk++)
+    for (int c = 0; c < 4; c++)
+      out[kk * 4 + c] = (4 * g + c < n) ? b[(long)kk * n + 4 * g + c] : 0;
+}
+
+/*A method to compute rows [r0, r1) of C = A * B with B packed, 4 columns of C per register*/
+void multiplyRows(const double* a, const double* packed, double* c, int k, int n, int r0, int r1){
+  int groups = (n + 3) / 4;
+  for (int i = r0; i < r1; i++) {
+    const double* ai = a + (long)i * k;
+    for (int g = 0; g < groups; g++) {
+      const double* bg = packed + (long)g * k * 4;
+      __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+      int kk = 0;
+      for (; kk + 2 <= k; kk += 2) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ai[kk]), _mm256_loadu_pd(&bg[kk * 4])));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_set1_pd(ai[kk+1]), _mm256_loadu_pd(&bg[kk * 4 + 4])));
+      }
+      if (kk < k) acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ai[kk]), _mm256_loadu_pd(&bg[kk * 4])));
+      double out[4];
+      _mm256_storeu_pd(out, _mm256_add_pd(acc0, acc1));
+      for (int c4 = 0; c4 < 4 && 4 * g + c4 < n; c4++) c[(long)i * n + 4 * g + c4] = out[c4];
+    }
+  }
+}
+
+/*A slice of a batch: panels or rows [begin, end) of one job*/
+struct WorkItem {
+  int job, begin, end;
+};
+
+/*
+ * A method to run a batch as one batched multiply: one parallel loop packs the B panels of
+ * every job, a second computes the row blocks of every job, so a batch of small requests costs
+ * two parallel regions instead of two per request.
+ */
+void runBatch(vector<Job*>& batch, BufferPool& pool){
+  vector<long> capacity(batch.size());
+  vector<WorkItem> panels, rows;
+  size_t held = 0;                //jobs whose packing buffer has been acquired
+  try {
+    for (size_t j = 0; j < batch.size(); j++) {
+      const Request& r = batch[j]->req;
+      int groups = (r.n + 3) / 4;
+      batch[j]->packed = pool.acquire((long)groups * r.k * 4, capacity[j]);
+      held = j + 1;
+      for (int g = 0; g < groups; g++) panels.push_back(WorkItem{(int)j, g, g + 1});
+      for (int i = 0; i < (int)r.m; i += BLOCK_ROWS) rows.push_back(WorkItem{(int)j, i, min(i + BLOCK_ROWS, (int)r.m)});
+    }
+  }
+  catch (bad_alloc&) {            //give back what the batch already holds
+    for (size_t h = 0; h < held; h++) pool.release(batch[h]->packed, capacity[h]);
+    throw;
+  }
+
+  #pragma omp parallel
+  {
+    #pragma omp for schedule(dynamic, 4)
+    for (size_t p = 0; p < panels.size(); p++) {
+      const Job* job = batch[panels[p].job];
+      packPanel(job->b, job->packed, job->req.k, job->req.n, panels[p].begin);
+    }
+    #pragma omp for schedule(dynamic)
+    for (size_t w = 0; w < rows.size(); w++) {
+      const Job* job = batch[rows[w].job];
+      multiplyRows(job->a, job->packed, job->c, job->req.k, job->req.n, rows[w].begin, rows[w].end);
+    }
+  }
+
+  for (size_t j = 0; j < batch.size(); j++) pool.release(batch[j]->packed, capacity[j]);
+}
+
+/*
+ * A method to map the object named by a request, reusing the connection's current mapping if
+ * the name still refers to the same object (device and inode) and it is large enough. Returns
+ * 0 or an errno value; EINVAL for bad dimensions or an object too small for them.
+ */
+int mapRequest(Connection& conn, const Request& req, Job& job){
+  size_t need;
+  if (!objectBytes(req.m, req.k, req.n, need)) return EINVAL;
+  string name(req.shm, strnlen(req.shm, sizeof(req.shm)));
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) return errno;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < need) { close(fd); return EINVAL; }
+  if (!conn.mapping || conn.mapping->name != name || conn.mapping->dev != st.st_dev
+      || conn.mapping->ino != st.st_ino || conn.mapping->bytes < need) {
+    shared_ptr<Mapping> m(new Mapping());
+    m->name = name;
+    m->dev = st.st_dev;
+    m->ino = st.st_ino;
+    m->bytes = st.st_size;
+    m->base = mmap(NULL, m->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m->base == MAP_FAILED) { int error = errno; close(fd); return error; }
+    conn.mapping = m;
+  }
+  close(fd);
+  job.mapping = conn.mapping;
+  job.a = (double*)conn.mapping->base;
+  job.b = job.a + (long)req.m * req.k;
+  job.c = job.b + (long)req.k * req.n;
+  return 0;
+}
+
+/*The state shared by the accept loop, the connection readers and the compute thread*/
+struct Server {
+  int listenFd;
+  JobQueue queue;
+  long served = 0, batches = 0;
+
+  explicit Server(microseconds window) : queue(window) {}
+
+  /*The reader of one connection: maps and queues requests until the client hangs up*/
+  void readLoop(shared_ptr<Connection> conn){
+    Request req;
+    while (readFully(conn->fd, &req, sizeof(req))) {
+      if (req.op == OP_SHUTDOWN) {
+        queue.stop();
+        shutdown(listenFd, SHUT_RDWR);    //wakes the accept loop
+        return;
+      }
+      Job* job = new Job();
+      job->conn = conn;
+      job->req = req;
+      job->arrived = high_resolution_clock::now();
+      int status = req.op == OP_MULTIPLY ? mapRequest(*conn, req, *job) : EINVAL;
+      if (status == 0 && !queue.push(job)) status = ECANCELED;
+      if (status != 0) {
+        Response r = {req.id, status, 0, 0, 0};
+        conn->reply(r);
+        delete job;
+      }
+    }
+  }
+
+  /*The compute thread: runs batches and replies with the timings of each request*/
+  void computeLoop(){
+    #pragma omp parallel
+    {}                          //start this thread's OpenMP team now rather than on the first request
+
+    BufferPool pool;
+    while (true) {
+      vector<Job*> batch = queue.takeBatch();
+      if (batch.empty()) break;
+      high_resolution_clock::time_point start = high_resolution_clock::now();
+      int status = 0;
+      try {
+        runBatch(batch, pool);
+      }
+      catch (bad_alloc&) {
+        status = ENOMEM;
+      }
+      high_resolution_clock::time_point end = high_resolution_clock::now();
+      for (Job* job : batch) {
+        Response r;
+        r.id = job->req.id;
+        r.status = status;
+        r.batch = batch.size();
+        r.queueUs = (double)duration_cast<nanoseconds>( start - job->arrived ).count()/1000;
+        r.computeUs = (double)duration_cast<nanoseconds>( end - start ).count()/1000;
+        job->conn->reply(r);
+        delete job;
+      }
+      served += batch.size();
+      batches++;
+    }
+    cerr<<"served "<<served<<" requests in "<<batches<<" batches ("<<(batches ? (double)served / batches : 0)
+        <<" per batch), packing buffers: "<<pool.allocations<<" allocated, "<<pool.reuses<<" reused"<<endl;
+  }
+};
+
+/*A method to run the daemon until a client sends OP_SHUTDOWN*/
+int serve(const string& path, microseconds window){
+  signal(SIGPIPE, SIG_IGN);     //a client that hangs up early must not kill the daemon
+  Server server(window);
+  sockaddr_un addr = address(path);
+  unlink(path.c_str());
+  server.listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server.listenFd < 0 || bind(server.listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(server.listenFd, 64) != 0) {
+    perror("socket");
+    return 1;
+  }
+
+  thread computer([&] { server.computeLoop(); });
+  cerr<<"listening on "<<path<<" with "<<omp_get_max_threads()<<" threads"<<endl;
+  vector<shared_ptr<Connection> > connections;
+  vector<thread> readers;
+  while (true) {
+    int fd = accept(server.listenFd, NULL, NULL);
+    if (fd < 0) break;
+    connections.push_back(shared_ptr<Connection>(new Connection(fd)));
+    shared_ptr<Connection> conn = connections.back();
+    readers.push_back(thread([&server, conn] { server.readLoop(conn); }));
+  }
+
+  computer.join();              //every queued request has been answered
+  for (size_t c = 0; c < connections.size(); c++) shutdown(connections[c]->fd, SHUT_RDWR);
+  for (size_t r = 0; r < readers.size(); r++) readers[r].join();
+  close(server.listenFd);
+  unlink(path.c_str());
+  return 0;
+}
+
+
+/*A method to connect to the daemon, retrying for a while in case it is still starting*/
+int connectTo(const string& path){
+  sockaddr_un addr = address(path);
+  for (int attempt = 0; attempt < 200; attempt++) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) return fd;
+    close(fd);
+    this_thread::sleep_for(milliseconds(10));
+  }
+  perror("connect");
+  exit(1);
+}
+
+int stopServer(const string& path){
+  int fd = connectTo(path);
+  Request req;
+  memset(&req, 0, sizeof(req));
+  req.op = OP_SHUTDOWN;
+  writeFully(fd, &req, sizeof(req));
+  close(fd);
+  return 0;
+}
+
+/*
+ * A method to send requests size x size multiplies from clients threads, each with its own
+ * connection and shared memory object and one request in flight, and report the latencies
+ * seen by the clients and the daemon's batching.
+ */
+int runClients(const string& path, int size, int requests, int clients){
+  vector<vector<double> > latency(clients);
+  vector<double> queueUs(clients), computeUs(clients), batchSizes(clients), maxDiff(clients);
+  int failures = 0;
+  mutex failureLock;
+
+  vector<thread> threads;
+  for (int t = 0; t < clients; t++) {
+    threads.push_back(thread([&, t] {
+      int fd = connectTo(path);
+      string name = "/mmserver-" + to_string(getpid()) + "-" + to_string(t);
+      size_t bytes;
+      if (!objectBytes(size, size, size, bytes)) { cerr<<"matrix size too large"<<endl; exit(1); }
+      int shm = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+      if (shm < 0 || ftruncate(shm, bytes) != 0) { perror("shm_open"); exit(1); }
+      double* a = (double*)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+      close(shm);
+      if (a == MAP_FAILED) { perror("mmap"); exit(1); }
+      double* b = a + (long)size * size;
+      double* c = b + (long)size * size;
+
+      std::mt19937 gen(t);
+      std::uniform_real_distribution<> dis(0,8);
+      for (int r = t; r < requests; r += clients) {
+        for (long e = 0; e < 2L * size * size; e++) a[e] = dis(gen);
+
+        Request req;
+        memset(&req, 0, sizeof(req));
+        req.op = OP_MULTIPLY;
+        req.m = req.k = req.n = size;
+        req.id = r;
+        strncpy(req.shm, name.c_str(), sizeof(req.shm) - 1);
+        Response resp;
+        high_resolution_clock::time_point sent = high_resolution_clock::now();
+        if (!writeFully(fd, &req, sizeof(req)) || !readFully(fd, &resp, sizeof(resp)) || resp.status != 0) {
+          lock_guard<mutex> guard(failureLock);
+          failures++;
+          continue;
+        }
+        latency[t].push_back((double)duration_cast<nanoseconds>( high_resolution_clock::now() - sent ).count()/1000);
+        queueUs[t] += resp.queueUs;
+        computeUs[t] += resp.computeUs;
+        batchSizes[t] += resp.batch;
+
+        if (r == t) {   //check the first product of every client
+          for (int i = 0; i < size; i++)
+            for (int j = 0; j < size; j++) {
+              double ref = 0;
+              for (int k = 0; k < size; k++) ref += a[(long)i * size + k] * b[(long)k * size + j];
+              maxDiff[t] = max(maxDiff[t], fabs(ref - c[(long)i * size + j]) / ref);
+            }
+        }
+      }
+      munmap(a, bytes);
+      shm_unlink(name.c_str());
+      close(fd);
+    }));
+  }
+  for (thread& t : threads) t.join();
+
+  vector<double> all;
+  double queueTotal = 0, computeTotal = 0, batchTotal = 0, diff = 0;
+  for (int t = 0; t < clients; t++) {
+    all.insert(all.end(), latency[t].begin(), latency[t].end());
+    queueTotal += queueUs[t];
+    computeTotal += computeUs[t];
+    batchTotal += batchSizes[t];
+    diff = max(diff, maxDiff[t]);
+  }
+  if (all.empty()) {
+    cout<<"no request succeeded"<<endl;
+    return 1;
+  }
+  sort(all.begin(), all.end());
+  double mean = 0;
+  for (double l : all) mean += l;
+  mean /= all.size();
+  cout<<all.size()<<" requests of "<<size<<"x"<<size<<" from "<<clients<<" clients, "<<failures<<" failed"<<endl;
+  cout<<"latency (us): mean "<<mean<<", p50 "<<all[all.size() / 2]<<", p99 "<<all[min(all.size() - 1, all.size() * 99 / 100)]
+      <<", max "<<all.back()<<endl;
+  cout<<"in the daemon (us): mean queueing "<<queueTotal / all.size()<<", mean batch duration "<<computeTotal / all.size()
+      <<", mean batch size "<<batchTotal / all.size()<<endl;
+  cout<<"max relative difference = "<<diff<<endl;
+  return failures ? 1 : 0;
+}
+
+/*A method that starts a daemon in a child process, runs the clients against it and stops it*/
+int demo(int size, int requests, int clients){
+  string path = "/tmp/mmserver-" + to_string(getpid()) + ".sock";
+  pid_t pid = fork();        //before the parent has started any OpenMP threads
+  if (pid < 0) { perror("fork"); return 1; }
+  if (pid == 0) _exit(serve(path, microseconds(200)));
+
+  int status = runClients(path, size, requests, clients);
+  stopServer(path);
+  waitpid(pid, NULL, 0);
+  return status;
+}
+
+int main(int argc, const char* argv[]) {
+
+  string cmd = argc > 1 ? argv[1] : "";
+  if (cmd == "serve" && argc >= 3) {
+    return serve(argv[2], microseconds(argc > 3 ? atol(argv[3]) : 200));
+  }
+  else if (cmd == "client" && argc >= 5) {
+    return runClients(argv[2], atoi(argv[3]), atoi(argv[4]), argc > 5 ? atoi(argv[5]) : 4);
+  }
+  else if (cmd == "stop" && argc >= 3) {
+    return stopServer(argv[2]);
+  }
+  else if (cmd == "demo" && argc >= 4) {
+    return demo(atoi(argv[2]), atoi(argv[3]), argc > 4 ? atoi(argv[4]) : 4);
+  }
+  cerr<<"usage: "<<argv[0]<<" serve <socket_path> [batch_window_us]"<<endl;
+  cerr<<"       "<<argv[0]<<" client <socket_path> <size> <requests> [client_threads]"<<endl;
+  cerr<<"       "<<argv[0]<<" stop <socket_path>"<<endl;
+  cerr<<"       "<<argv[0]<<" demo <size> <requests> [client_threads]"<<endl;
+  return 1;
+}
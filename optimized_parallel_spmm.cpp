@@ -0,0 +1,326 @@
+/**
+ * Parallel program to perform sparse (CSR / CSC) times dense matrix multiplication
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_spmm.cpp -o optimized_parallel_spmm
+ *  (run): ./optimized_parallel_spmm <matrix_size> [density]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+
+/*A sparse matrix in compressed sparse row format*/
+struct CSRMatrix {
+  int rows, cols;
+  vector<int> rowPtr;     //row i holds entries rowPtr[i] .. rowPtr[i+1]-1
+  vector<int> colIdx;
+  vector<double> values;
+};
+
+/*A sparse matrix in compressed sparse column format*/
+struct CSCMatrix {
+  int rows, cols;
+  vector<int> colPtr;     //column j holds entries colPtr[j] .. colPtr[j+1]-1
+  vector<int> rowIdx;
+  vector<double> values;
+};
+
+
+/*A method to initialize a matrix*/
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to get the transpose matrix of a given matrix*/
+double** getTranspose(double** matrix, int size){
+  for (int row = 0; row < size; row++) {
+    for (int col = row+1; col < size; col++) {
+      std::swap(matrix[row][col], matrix[col][row]);
+    }
+  }
+  return matrix;
+}
+
+/*A method to populate a matrix with random values*/
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*A method to populate a matrix with random values, keeping each element with the given probability*/
+void populateSparseMat(double** matrix, int size, double density){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);
+  std::uniform_real_distribution<> keep(0,1);
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = keep(gen) < density ? dis(gen) : 0;
+    }
+  }
+}
+
+/*A method to convert a dense matrix to CSR*/
+CSRMatrix toCSR(double** matrix, int size){
+  CSRMatrix csr;
+  csr.rows = csr.cols = size;
+  csr.rowPtr.assign(size + 1, 0);
+
+  vector<int> counts(size, 0);
+  #pragma omp parallel for
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      if (matrix[row][col] != 0) counts[row]++;
+    }
+  }
+  for (int row = 0; row < size; row++) {
+    csr.rowPtr[row+1] = csr.rowPtr[row] + counts[row];
+  }
+  csr.colIdx.resize(csr.rowPtr[size]);
+  csr.values.resize(csr.rowPtr[size]);
+
+  #pragma omp parallel for
+  for (int row = 0; row < size; row++) {
+    int p = csr.rowPtr[row];
+    for (int col = 0; col < size; col++) {
+      if (matrix[row][col] != 0) {
+        csr.colIdx[p] = col;
+        csr.values[p++] = matrix[row][col];
+      }
+    }
+  }
+  return csr;
+}
+
+/*A method to convert a dense matrix to CSC*/
+CSCMatrix toCSC(double** matrix, int size){
+  CSCMatrix csc;
+  csc.rows = csc.cols = size;
+  csc.colPtr.assign(size + 1, 0);
+
+  vector<int> counts(size, 0);
+  #pragma omp parallel for
+  for (int col = 0; col < size; col++) {
+    for (int row = 0; row < size; row++) {
+      if (matrix[row][col] != 0) counts[col]++;
+    }
+  }
+  for (int col = 0; col < size; col++) {
+    csc.colPtr[col+1] = csc.colPtr[col] + counts[col];
+  }
+  csc.rowIdx.resize(csc.colPtr[size]);
+  csc.values.resize(csc.colPtr[size]);
+
+  #pragma omp parallel for
+  for (int col = 0; col < size; col++) {
+    int p = csc.colPtr[col];
+    for (int row = 0; row < size; row++) {
+      if (matrix[row][col] != 0) {
+        csc.rowIdx[p] = row;
+        csc.values[p++] = matrix[row][col];
+      }
+    }
+  }
+  return csc;
+}
+
+/*
+ * A method to split the rows of a CSR matrix into one contiguous range per thread
+ * holding about the same number of non zeros (rowPtr is already the prefix sum).
+ */
+vector<int> nnzBalancedRows(const CSRMatrix& csr, int threads){
+  vector<int> bounds(threads + 1, csr.rows);
+  bounds[0] = 0;
+  long total = csr.rowPtr[csr.rows];
+  int row = 0;
+  for (int t = 1; t < threads; t++) {
+    long target = total * t / threads;
+    while (row < csr.rows && csr.rowPtr[row] < target) row++;
+    bounds[t] = row;
+  }
+  return bounds;
+}
+
+/*A method to perform C[i][j0..j1) += v * B[k][j0..j1) with 256 bit vectors*/
+inline void axpy(double* c, const double* b, double v, int j0, int j1){
+  __m256d vv = _mm256_set1_pd(v);
+  int j = j0;
+  for (; j + 4 <= j1; j += 4) {
+    _mm256_storeu_pd(&c[j], _mm256_add_pd(_mm256_loadu_pd(&c[j]), _mm256_mul_pd(vv, _mm256_loadu_pd(&b[j]))));
+  }
+  for (; j < j1; j++) {
+    c[j] += v * b[j];
+  }
+}
+
+/*
+ * A method to perform C = A * B with A in CSR. Row i of C is the sum of v * B[k] over the
+ * non zeros (k, v) of row i of A, so B is streamed row-wise and never transposed.
+ */
+double spmm_csr(const CSRMatrix& csr, double **matB, double **matC, int size){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  vector<int> bounds;
+
+  #pragma omp parallel
+  {
+    int threads = omp_get_num_threads();
+    int t = omp_get_thread_num();
+    #pragma omp single
+    bounds = nnzBalancedRows(csr, threads);     //for the team actually started; the barrier publishes it
+
+    for (int i = bounds[t]; i < bounds[t+1]; i++) {
+      double* c = matC[i];
+      for (int j = 0; j < size; j++) c[j] = 0;
+      for (int p = csr.rowPtr[i]; p < csr.rowPtr[i+1]; p++) {
+        axpy(c, matB[csr.colIdx[p]], csr.values[p], 0, size);
+      }
+    }
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;   //Get duration in milli seconds
+}
+
+/*
+ * A method to perform C = A * B with A in CSC. Column k of A scatters into many rows of C,
+ * so every thread owns a band of columns of C and walks all of A for that band.
+ */
+double spmm_csc(const CSCMatrix& csc, double **matB, double **matC, int size){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  #pragma omp parallel
+  {
+    int threads = omp_get_num_threads();
+    int t = omp_get_thread_num();
+    int band = ((size + threads - 1) / threads + 3) / 4 * 4;   //multiple of 4 so bands start vector aligned
+    int j0 = min(size, t * band), j1 = min(size, j0 + band);
+
+    for (int i = 0; i < size; i++)
+      for (int j = j0; j < j1; j++) matC[i][j] = 0;
+
+    for (int k = 0; k < size; k++) {
+      for (int p = csc.colPtr[k]; p < csc.colPtr[k+1]; p++) {
+        axpy(matC[csc.rowIdx[p]], matB[k], csc.values[p], j0, j1);
+      }
+    }
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;
+}
+
+/*A method to perform the dense AVX multiplication, for comparison*/
+double mat_multiply_avx(double **matA, double **trans_matB, double **matC, int size){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      __m256d c = _mm256_setzero_pd();
+      int k = 0;
+      for (; k + 4 <= size; k += 4) {
+        c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&matA[i][k]), _mm256_loadu_pd(&trans_matB[j][k])));
+      }
+      double tempresult[4];
+      _mm256_storeu_pd(tempresult, c);
+      double sum = tempresult[0]+tempresult[1]+tempresult[2]+tempresult[3];
+      for (; k < size; k++) {
+        sum += matA[i][k]*trans_matB[j][k];
+      }
+      matC[i][j] = sum;
+    }
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;
+}
+
+/*A method that multiplies a random sparse matrix by a random dense matrix with the dense, CSR and CSC kernels*/
+void matMultiply(int size, double density){
+  double** matA = initMat(size);    //Initialize the sparse matrix A
+  double** matB = initMat(size);    //Initialize the dense matrix B
+  double** matDense = initMat(size);
+  double** matCSR = initMat(size);
+  double** matCSC = initMat(size);
+  populateSparseMat(matA, size, density);
+  populateMat(matB, size);
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();
+  CSRMatrix csr = toCSR(matA, size);
+  CSCMatrix csc = toCSC(matA, size);
+  double convert = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  double csrTime = spmm_csr(csr, matB, matCSR, size);
+  double cscTime = spmm_csc(csc, matB, matCSC, size);
+  double** trans_matB = getTranspose(matB,size);
+  double denseTime = mat_multiply_avx(matA, trans_matB, matDense, size);
+
+  double maxDiff = 0;
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      maxDiff = max(maxDiff, fabs(matDense[i][j] - matCSR[i][j]));
+      maxDiff = max(maxDiff, fabs(matDense[i][j] - matCSC[i][j]));
+    }
+  }
+
+  cout<<"nnz = "<<csr.rowPtr[size]<<" ("<<100.0*csr.rowPtr[size]/((double)size*size)<<"%)"<<endl;
+  cout<<"dense -> CSR + CSC conversion: "<<convert<<"ms"<<endl;
+  cout<<"dense AVX multiply: "<<denseTime<<"ms"<<endl;
+  cout<<"CSR SpMM:           "<<csrTime<<"ms"<<endl;
+  cout<<"CSC SpMM:           "<<cscTime<<"ms"<<endl;
+  cout<<"max difference = "<<maxDiff<<endl;
+
+  freeMat(matA, size);
+  freeMat(matB, size);
+  freeMat(matDense, size);
+  freeMat(matCSR, size);
+  freeMat(matCSC, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [density]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  double density = argc > 2 ? atof(argv[2]) : 0.05;
+  matMultiply(size, density);
+  return 0;
+}
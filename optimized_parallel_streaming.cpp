@@ -0,0 +1,307 @@
+/**
+ * Parallel program to multiply a matrix A that arrives row panel by row panel on a pipe or
+ * file descriptor by a fixed, pre-packed matrix B, writing every C panel as soon as it is ready
+ *
+ * A arrives and C leaves as raw row-major doubles. B is k x n, generated from a seed.
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp -pthread optimized_parallel_streaming.cpp -o optimized_parallel_streaming
+ *  (run): ./optimized_parallel_streaming generate <rows> <k> [delay_ms_per_row] | ./optimized_parallel_streaming multiply <k> <n> [panel_rows] [seed] > C.bin
+ *         ./optimized_parallel_streaming demo <rows> <k> <n> [delay_ms_per_row]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define QUEUE_DEPTH 4     //panels that may wait between two stages
+
+/*A row panel of A (rows x k) or C (rows x n); rows == 0 marks the end of the stream*/
+struct Panel {
+  long index;
+  int rows;
+  vector<double> data;
+};
+
+/*
+ * A blocking queue of at most capacity panels. push() waits while it is full, which is what
+ * keeps a fast reader from running arbitrarily far ahead of compute (and compute of the writer).
+ */
+struct BoundedQueue {
+  deque<Panel*> items;
+  size_t capacity;
+  mutex lock;
+  condition_variable notFull, notEmpty;
+
+  explicit BoundedQueue(size_t c) : capacity(c) {}
+
+  void push(Panel* p){
+    unique_lock<mutex> guard(lock);
+    notFull.wait(guard, [this] { return items.size() < capacity; });
+    items.push_back(p);
+    notEmpty.notify_one();
+  }
+
+  Panel* pop(){
+    unique_lock<mutex> guard(lock);
+    notEmpty.wait(guard, [this] { return !items.empty(); });
+    Panel* p = items.front();
+    items.pop_front();
+    notFull.notify_one();
+    return p;
+  }
+};
+
+/*Timings of one streamed multiply*/
+struct StreamStats {
+  high_resolution_clock::time_point firstInput, firstOutput, done;
+  long rows;
+};
+
+
+/*A method to read exactly count bytes unless the stream ends first; returns the bytes read*/
+size_t readFully(int fd, void* buf, size_t count){
+  char* p = (char*)buf;
+  size_t got = 0;
+  while (got < count) {
+    ssize_t n = read(fd, p + got, count - got);
+    if (n < 0) { perror("read"); exit(1); }
+    if (n == 0) break;
+    got += n;
+  }
+  return got;
+}
+
+/*A method to write count bytes*/
+void writeFully(int fd, const void* buf, size_t count){
+  const char* p = (const char*)buf;
+  while (count > 0) {
+    ssize_t n = write(fd, p, count);
+    if (n <= 0) { perror("write"); exit(1); }
+    p += n; count -= n;
+  }
+}
+
+/*A method to generate the k x n matrix B from a seed, row-major*/
+vector<double> generateB(int k, int n, unsigned seed){
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+  vector<double> b((long)k * n);
+  for (long e = 0; e < (long)k * n; e++) b[e] = dis(gen);
+  return b;
+}
+
+/*
+ * A method to pack B into column panels of 4: panel g holds B[kk][4g..4g+3] for every kk,
+ * contiguously, so the kernel reads B with unit stride. The last panel is zero padded.
+ */
+vector<double> packB(const vector<double>& b, int k, int n){
+  int groups = (n + 3) / 4;
+  vector<double> packed((long)groups * k * 4, 0.0);
+  for (int g = 0; g < groups; g++)
+    for (int kk = 0; kk < k; kk++)
+      for (int c = 0; c < 4 && 4 * g + c < n; c++)
+        packed[((long)g * k + kk) * 4 + c] = b[(long)kk * n + 4 * g + c];
+  return packed;
+}
+
+/*A method to compute the C panel for an A panel: every row times the packed B, 4 columns per register*/
+void multiplyPanel(const Panel& a, const vector<double>& packedB, Panel& c, int k, int n){
+  int groups = (n + 3) / 4;
+  c.index = a.index;
+  c.rows = a.rows;
+  c.data.resize((long)a.rows * n);
+
+  #pragma omp parallel for collapse(2) schedule(static)
+  for (int i = 0; i < a.rows; i++) {
+    for (int g = 0; g < groups; g++) {
+      const double* ai = &a.data[(long)i * k];
+      const double* bg = &packedB[(long)g * k * 4];
+      __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+      int kk = 0;
+      for (; kk + 2 <= k; kk += 2) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ai[kk]), _mm256_loadu_pd(&bg[kk * 4])));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_set1_pd(ai[kk+1]), _mm256_loadu_pd(&bg[kk * 4 + 4])));
+      }
+      if (kk < k) acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_set1_pd(ai[kk]), _mm256_loadu_pd(&bg[kk * 4])));
+      double out[4];
+      _mm256_storeu_pd(out, _mm256_add_pd(acc0, acc1));
+      for (int c4 = 0; c4 < 4 && 4 * g + c4 < n; c4++) c.data[(long)i * n + 4 * g + c4] = out[c4];
+    }
+  }
+}
+
+/*
+ * A method to multiply the A stream on inFd by B, writing C to outFd. Three stages run
+ * concurrently, connected by bounded queues: a reader thread cuts the input into panels of
+ * panelRows rows, this thread multiplies each panel with all OpenMP threads, and a writer
+ * thread writes the C panels in order. Panels are recycled through a free queue.
+ */
+StreamStats streamMultiply(int inFd, int outFd, const vector<double>& packedB, int k, int n, int panelRows){
+  StreamStats stats;
+  stats.rows = 0;
+  stats.firstInput = stats.firstOutput = high_resolution_clock::now();
+  BoundedQueue freeA(QUEUE_DEPTH), fullA(QUEUE_DEPTH), freeC(QUEUE_DEPTH), fullC(QUEUE_DEPTH);
+  for (int q = 0; q < QUEUE_DEPTH; q++) {
+    freeA.push(new Panel());
+    freeC.push(new Panel());
+  }
+
+  thread reader([&] {
+    size_t rowBytes = (size_t)k * sizeof(double);
+    for (long index = 0; ; index++) {
+      Panel* p = freeA.pop();
+      p->index = index;
+      p->data.resize((long)panelRows * k);
+      size_t got = 0;
+      for (int r = 0; r < panelRows; r++) {    //row by row, so a panel of a slow producer is handed on as soon as it is full
+        size_t n = readFully(inFd, &p->data[(long)r * k], rowBytes);
+        if (got == 0 && n > 0 && index == 0) stats.firstInput = high_resolution_clock::now();
+        got += n;
+        if (n < rowBytes) break;
+      }
+      p->rows = got / rowBytes;
+      fullA.push(p);
+      if (p->rows < panelRows) {
+        if (p->rows > 0) { Panel* end = freeA.pop(); end->rows = 0; fullA.push(end); }
+        return;
+      }
+    }
+  });
+
+  thread writer([&] {
+    bool first = true;
+    while (true) {
+      Panel* c = fullC.pop();
+      if (c->rows == 0) { freeC.push(c); return; }
+      writeFully(outFd, &c->data[0], (size_t)c->rows * n * sizeof(double));
+      if (first) { stats.firstOutput = high_resolution_clock::now(); first = false; }
+      freeC.push(c);
+    }
+  });
+
+  while (true) {
+    Panel* a = fullA.pop();
+    Panel* c = freeC.pop();
+    if (a->rows == 0) {
+      c->rows = 0;
+      fullC.push(c);
+      freeA.push(a);
+      break;
+    }
+    multiplyPanel(*a, packedB, *c, k, n);
+    stats.rows += a->rows;
+    freeA.push(a);
+    fullC.push(c);
+  }
+
+  reader.join();
+  writer.join();
+  stats.done = high_resolution_clock::now();
+  for (int q = 0; q < QUEUE_DEPTH; q++) {
+    delete freeA.pop();
+    delete freeC.pop();
+  }
+  return stats;
+}
+
+/*A method to write rows random rows of length k to fd, sleeping delayMs after each row*/
+void generateA(int fd, long rows, int k, double delayMs, unsigned seed){
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<> dis(0,8);
+  vector<double> row(k);
+  for (long r = 0; r < rows; r++) {
+    for (int c = 0; c < k; c++) row[c] = dis(gen);
+    writeFully(fd, &row[0], k * sizeof(double));
+    if (delayMs > 0) this_thread::sleep_for(microseconds((long)(delayMs * 1000)));
+  }
+}
+
+/*A method to print the timings of a streamed multiply*/
+void report(const StreamStats& stats, int n){
+  double firstMs = (double)duration_cast<nanoseconds>( stats.firstOutput - stats.firstInput ).count()/1000000;
+  double totalMs = (double)duration_cast<nanoseconds>( stats.done - stats.firstInput ).count()/1000000;
+  cerr<<stats.rows<<" rows of C ("<<n<<" columns) streamed in "<<totalMs<<"ms"<<endl;
+  cerr<<"latency from the first A row to the first C panel written = "<<firstMs<<"ms"<<endl;
+}
+
+/*
+ * A method that runs producer, streaming multiply and a checking consumer in one process,
+ * connected by pipes, and compares the streamed C with a multiply of the whole matrix.
+ */
+void demo(long rows, int k, int n, double delayMs){
+  int panelRows = 16;
+  unsigned seedA = 7, seedB = 11;
+  vector<double> packedB = packB(generateB(k, n, seedB), k, n);
+
+  int aPipe[2], cPipe[2];
+  if (pipe(aPipe) != 0 || pipe(cPipe) != 0) { perror("pipe"); exit(1); }
+  thread producer([&] { generateA(aPipe[1], rows, k, delayMs, seedA); close(aPipe[1]); });
+  vector<double> c((long)rows * n);
+  size_t cBytes = 0;
+  thread consumer([&] { cBytes = readFully(cPipe[0], &c[0], c.size() * sizeof(double)); });
+
+  StreamStats stats = streamMultiply(aPipe[0], cPipe[1], packedB, k, n, panelRows);
+  close(cPipe[1]);
+  producer.join();
+  consumer.join();
+  close(aPipe[0]);
+  close(cPipe[0]);
+  report(stats, n);
+
+  std::mt19937 gen(seedA);      //regenerate A and B and multiply them whole
+  std::uniform_real_distribution<> dis(0,8);
+  vector<double> b = generateB(k, n, seedB);
+  double maxDiff = 0;
+  for (long r = 0; r < rows; r++) {
+    vector<double> a(k);
+    for (int kk = 0; kk < k; kk++) a[kk] = dis(gen);
+    for (int j = 0; j < n; j++) {
+      double ref = 0;
+      for (int kk = 0; kk < k; kk++) ref += a[kk] * b[(long)kk * n + j];
+      maxDiff = max(maxDiff, fabs(ref - c[r * n + j]) / ref);
+    }
+  }
+  cerr<<"received "<<cBytes / sizeof(double) / n<<" rows, max relative difference = "<<maxDiff<<endl;
+}
+
+int main(int argc, const char* argv[]) {
+
+  string cmd = argc > 1 ? argv[1] : "";
+  if (cmd == "generate" && argc >= 4) {
+    generateA(1, atol(argv[2]), atoi(argv[3]), argc > 4 ? atof(argv[4]) : 0, 7);
+  }
+  else if (cmd == "multiply" && argc >= 4) {
+    int k = atoi(argv[2]), n = atoi(argv[3]);
+    int panelRows = argc > 4 ? atoi(argv[4]) : 16;
+    unsigned seed = argc > 5 ? atoi(argv[5]) : 11;
+    vector<double> packedB = packB(generateB(k, n, seed), k, n);   //packed once, before the first A row arrives
+    report(streamMultiply(0, 1, packedB, k, n, panelRows), n);
+  }
+  else if (cmd == "demo" && argc >= 5) {
+    demo(atol(argv[2]), atoi(argv[3]), atoi(argv[4]), argc > 5 ? atof(argv[5]) : 0);
+  }
+  else {
+    cerr<<"usage: "<<argv[0]<<" generate <rows> <k> [delay_ms_per_row]"<<endl;
+    cerr<<"       "<<argv[0]<<" multiply <k> <n> [panel_rows] [seed]"<<endl;
+    cerr<<"       "<<argv[0]<<" demo <rows> <k> <n> [delay_ms_per_row]"<<endl;
+    return 1;
+  }
+  return 0;
+}
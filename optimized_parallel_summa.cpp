@@ -0,0 +1,459 @@
+/**
+ * Parallel program to multiply two matrices with SUMMA on a q x q grid of worker processes
+ *
+ * Rank (i,j) owns block (i,j) of A, B and C. In step k the owner of A(i,k) broadcasts it along
+ * process row i, the owner of B(k,j) broadcasts it along process column j, and every rank adds
+ * A(i,k) * B(k,j) to its C block with the AVX kernel of optimized_parallel_avx.cpp. The
+ * communication layer is pluggable: POSIX shared memory, where every channel is a double
+ * buffer of fixed size that blocks stream through in chunks, or Unix-domain sockets, with all
+ * ranks forked on this machine.
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_summa.cpp -o optimized_parallel_summa -lrt
+ *  (run): ./optimized_parallel_summa <matrix_size> <grid_dim> [shm|socket]
+ *
+ *
+ */
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <new>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define CHANNELS 3        //per rank: 0 = A along its process row, 1 = B along its column, 2 = gather
+#define SHM_CHUNK 32768   //doubles per shared memory slot; each channel has two, so a broadcast is pipelined in chunks
+
+/*A method to read exactly count bytes*/
+void readFully(int fd, void* buf, size_t count){
+  char* p = (char*)buf;
+  while (count > 0) {
+    ssize_t n = read(fd, p, count);
+    if (n <= 0) { perror("read"); exit(1); }
+    p += n; count -= n;
+  }
+}
+
+/*A method to write count bytes*/
+void writeFully(int fd, const void* buf, size_t count){
+  const char* p = (const char*)buf;
+  while (count > 0) {
+    ssize_t n = write(fd, p, count);
+    if (n <= 0) { perror("write"); exit(1); }
+    p += n; count -= n;
+  }
+}
+
+/*
+ * The communication layer SUMMA needs. broadcast() copies count doubles from buf on root into
+ * buf on every other rank of group (which includes root); all members call it with the same
+ * arguments, and the channel keeps the row and column broadcasts of one step apart.
+ */
+class Comm {
+ public:
+  Comm(int rank, int size) : myRank(rank), ranks(size) {}
+  virtual ~Comm() {}
+  int rank() const { return myRank; }
+  int size() const { return ranks; }
+
+  virtual void broadcast(double* buf, size_t count, int root, const vector<int>& group, int channel) = 0;
+  virtual void barrier() = 0;
+
+  /*A method to collect count doubles from every rank into all (rank r at all + r*count) on root*/
+  void gather(const double* local, size_t count, double* all, int root){
+    if (myRank == root) memcpy(all + (long)root * count, local, count * sizeof(double));
+    for (int r = 0; r < ranks; r++) {
+      if (r == root) continue;
+      vector<int> pair = {root, r};
+      if (myRank == r) broadcast((double*)local, count, r, pair, 2);
+      else if (myRank == root) broadcast(all + (long)r * count, count, r, pair, 2);
+    }
+  }
+
+ protected:
+  int myRank, ranks;
+};
+
+/*
+ * One broadcast channel of a rank in the shared segment, with two data slots of SHM_CHUNK
+ * doubles. A broadcast goes through in chunks that alternate between the slots, so the root
+ * fills one while the receivers empty the other. Before reusing a slot the root waits until
+ * every receiver has acknowledged the chunk last put there; a receiver waits for the chunk
+ * count it expects, copies the chunk out and acknowledges it on that slot.
+ */
+struct ShmChannel {
+  atomic<long> seq;         //chunks published
+  atomic<long> acks[2];     //acknowledgements received, per slot
+  char pad[64 - 3 * sizeof(atomic<long>)];
+};
+
+/*The layout of the shared segment: a barrier, then ranks*CHANNELS channel headers, then their slots*/
+struct ShmSegment {
+  pthread_barrier_t barrier;
+  char pad[128 - sizeof(pthread_barrier_t) % 128];
+};
+
+class ShmComm : public Comm {
+ public:
+  /*
+   * A method to create and map the segment; called once in the parent before the ranks are
+   * forked. Its size depends on the number of ranks only, not on the block size.
+   */
+  static void* create(int ranks, size_t& bytes){
+    bytes = sizeof(ShmSegment) + (size_t)ranks * CHANNELS * (sizeof(ShmChannel) + 2 * SHM_CHUNK * sizeof(double));
+    string name = "/summa-" + to_string(getpid());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) { perror("shm_open"); exit(1); }
+    if (ftruncate(fd, bytes) != 0) { perror("ftruncate"); exit(1); }
+    void* base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) { perror("mmap"); exit(1); }
+    close(fd);
+    shm_unlink(name.c_str());       //the mapping stays valid in the parent and every forked rank
+
+    ShmSegment* seg = (ShmSegment*)base;
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&seg->barrier, &attr, ranks);
+    pthread_barrierattr_destroy(&attr);
+    ShmChannel* channels = (ShmChannel*)(seg + 1);
+    for (int c = 0; c < ranks * CHANNELS; c++) {
+      new (&channels[c].seq) atomic<long>(0);
+      new (&channels[c].acks[0]) atomic<long>(0);
+      new (&channels[c].acks[1]) atomic<long>(0);
+    }
+    return base;
+  }
+
+  ShmComm(int rank, int size, void* base)
+    : Comm(rank, size), seg((ShmSegment*)base), channels((ShmChannel*)(seg + 1)),
+      sent(CHANNELS, 0), expectedAcks(2 * CHANNELS, 0), seen((long)size * CHANNELS, 0) {
+    data = (double*)(channels + size * CHANNELS);
+  }
+
+  void broadcast(double* buf, size_t count, int root, const vector<int>& group, int channel){
+    int c = root * CHANNELS + channel;
+    for (size_t done = 0; done < count; done += SHM_CHUNK) {
+      size_t len = min((size_t)SHM_CHUNK, count - done);
+      if (myRank == root) {
+        int s = sent[channel] % 2;
+        double* slot = data + ((long)c * 2 + s) * SHM_CHUNK;
+        while (channels[c].acks[s].load(memory_order_acquire) < expectedAcks[2 * channel + s]) sched_yield();
+        memcpy(slot, buf + done, len * sizeof(double));
+        channels[c].seq.store(++sent[channel], memory_order_release);
+        expectedAcks[2 * channel + s] += group.size() - 1;
+      } else {
+        long want = ++seen[c];
+        int s = (want - 1) % 2;
+        double* slot = data + ((long)c * 2 + s) * SHM_CHUNK;
+        while (channels[c].seq.load(memory_order_acquire) < want) sched_yield();
+        memcpy(buf + done, slot, len * sizeof(double));
+        channels[c].acks[s].fetch_add(1, memory_order_release);
+      }
+    }
+  }
+
+  void barrier(){
+    pthread_barrier_wait(&seg->barrier);
+  }
+
+ private:
+  ShmSegment* seg;
+  ShmChannel* channels;
+  double* data;
+  vector<long> sent, expectedAcks, seen;
+};
+
+/*
+ * Unix-domain stream sockets, one connection per pair of ranks. The parent binds and listens on
+ * one socket path per rank before forking, so a rank can connect to any lower rank straight away
+ * and accepts the connections of the higher ones.
+ */
+class SocketComm : public Comm {
+ public:
+  /*The socket path of a rank; parent is the pid of the launching process*/
+  static string path(pid_t parent, int rank){
+    return "/tmp/summa-" + to_string(parent) + "-" + to_string(rank) + ".sock";
+  }
+
+  /*A method to create the listening socket of every rank; called once in the parent*/
+  static vector<int> listen(int ranks){
+    vector<int> listeners(ranks);
+    for (int r = 0; r < ranks; r++) {
+      sockaddr_un addr = address(path(getpid(), r));
+      unlink(addr.sun_path);
+      listeners[r] = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listeners[r] < 0 || bind(listeners[r], (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listeners[r], ranks) != 0) {
+        perror("socket"); exit(1);
+      }
+    }
+    return listeners;
+  }
+
+  static void unlinkAll(int ranks){
+    for (int r = 0; r < ranks; r++) unlink(path(getpid(), r).c_str());
+  }
+
+  /*Called in each rank after the fork, with the listeners inherited from the parent*/
+  SocketComm(int rank, int size, vector<int>& listeners, pid_t parent)
+    : Comm(rank, size), peers(size, -1) {
+    for (int r = 0; r < size; r++) if (r != rank) close(listeners[r]);
+    for (int r = 0; r < rank; r++) {
+      sockaddr_un addr = address(path(parent, r));
+      peers[r] = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (connect(peers[r], (sockaddr*)&addr, sizeof(addr)) != 0) { perror("connect"); exit(1); }
+      writeFully(peers[r], &rank, sizeof(int));
+    }
+    for (int n = rank + 1; n < size; n++) {
+      int fd = accept(listeners[rank], NULL, NULL);
+      if (fd < 0) { perror("accept"); exit(1); }
+      int from;
+      readFully(fd, &from, sizeof(int));
+      peers[from] = fd;
+    }
+    close(listeners[rank]);
+  }
+
+  ~SocketComm(){
+    for (int fd : peers) if (fd >= 0) close(fd);
+  }
+
+  /*Each message is tagged with its channel, so a receiver that got out of step stops at once*/
+  void broadcast(double* buf, size_t count, int root, const vector<int>& group, int channel){
+    if (myRank == root) {
+      for (int r : group) {
+        if (r == root) continue;
+        writeFully(peers[r], &channel, sizeof(int));
+        writeFully(peers[r], buf, count * sizeof(double));
+      }
+    } else {
+      int tag;
+      readFully(peers[root], &tag, sizeof(int));
+      if (tag != channel) {
+        cerr<<"rank "<<myRank<<": expected channel "<<channel<<" from rank "<<root<<", got "<<tag<<endl;
+        exit(1);
+      }
+      readFully(peers[root], buf, count * sizeof(double));
+    }
+  }
+
+  void barrier(){
+    char token = 0;
+    if (myRank == 0) {
+      for (int r = 1; r < ranks; r++) readFully(peers[r], &token, 1);
+      for (int r = 1; r < ranks; r++) writeFully(peers[r], &token, 1);
+    } else {
+      writeFully(peers[0], &token, 1);
+      readFully(peers[0], &token, 1);
+    }
+  }
+
+ private:
+  static sockaddr_un address(const string& p){
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, p.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+  }
+
+  vector<int> peers;
+};
+
+/*A method to generate element (i,j) of a matrix from a seed, so any rank can build any block*/
+inline double element(long i, long j, long n, unsigned long seed){
+  unsigned long z = seed * 0x9E3779B97F4A7C15UL + (unsigned long)(i * n + j);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+  z ^= z >> 31;
+  return (double)(z >> 11) / (double)(1UL << 53) * 8;   //in range 0-8
+}
+
+/*A method to fill the nb x nb block (bi,bj) of the n x n matrix, zero padded past n*/
+void generateBlock(double* block, int bi, int bj, int nb, int n, unsigned long seed){
+  for (int r = 0; r < nb; r++) {
+    for (int c = 0; c < nb; c++) {
+      long i = (long)bi * nb + r, j = (long)bj * nb + c;
+      block[(long)r * nb + c] = (i < n && j < n) ? element(i, j, n, seed) : 0;
+    }
+  }
+}
+
+/*A method to transpose an nb x nb row-major block into out*/
+void transposeBlock(const double* b, double* out, int nb){
+  #pragma omp parallel for
+  for (int i = 0; i < nb; i++)
+    for (int j = 0; j < nb; j++) out[(long)j * nb + i] = b[(long)i * nb + j];
+}
+
+/*
+ * The kernel of optimized_parallel_avx.cpp on nb x nb blocks, adding into C: every element is
+ * a dot product of a row of A and a row of B transposed, 4 doubles at a time (nb is a multiple of 4)
+ */
+void mat_multiply_avx_add(const double* a, const double* trans_b, double* c, int nb){
+  #pragma omp parallel for
+  for (int i = 0; i < nb; i++) {
+    for (int j = 0; j < nb; j++) {
+      __m256d acc = _mm256_setzero_pd();
+      double tempresult[4];
+      for (int k = 0; k < nb; k += 4) {
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(&a[(long)i * nb + k]), _mm256_loadu_pd(&trans_b[(long)j * nb + k])));
+      }
+      _mm256_storeu_pd(tempresult, acc);
+      c[(long)i * nb + j] += tempresult[0]+tempresult[1]+tempresult[2]+tempresult[3];
+    }
+  }
+}
+
+/*
+ * A method to run SUMMA on this rank's blocks: q steps of a row broadcast of A, a column
+ * broadcast of B and a local multiply-add. The ranks that own A(i,k) or B(k,j) broadcast straight
+ * from their own block.
+ */
+void summa(Comm& comm, int q, int nb, double* localA, double* localB, double* localC){
+  int pi = comm.rank() / q, pj = comm.rank() % q;
+  long blockSize = (long)nb * nb;
+  vector<double> aBuf(blockSize), bBuf(blockSize), trans(blockSize);
+  vector<int> rowGroup(q), colGroup(q);
+  for (int t = 0; t < q; t++) {
+    rowGroup[t] = pi * q + t;
+    colGroup[t] = t * q + pj;
+  }
+  memset(localC, 0, blockSize * sizeof(double));
+
+  for (int k = 0; k < q; k++) {
+    double* a = (pj == k) ? localA : &aBuf[0];
+    double* b = (pi == k) ? localB : &bBuf[0];
+    comm.broadcast(a, blockSize, pi * q + k, rowGroup, 0);
+    comm.broadcast(b, blockSize, k * q + pj, colGroup, 1);
+    transposeBlock(b, &trans[0], nb);
+    mat_multiply_avx_add(a, &trans[0], localC, nb);
+  }
+}
+
+/*
+ * The body of one rank: build the local blocks, time SUMMA between two barriers, gather C on
+ * rank 0 and have rank 0 check it against a single-process multiply of the whole matrices.
+ */
+void worker(Comm& comm, int n, int q, int nb){
+  int ranks = q * q;
+  int pi = comm.rank() / q, pj = comm.rank() % q;
+  unsigned long seedA = 7, seedB = 11;
+  long blockSize = (long)nb * nb;
+  vector<double> localA(blockSize), localB(blockSize), localC(blockSize);
+  generateBlock(&localA[0], pi, pj, nb, n, seedA);
+  generateBlock(&localB[0], pi, pj, nb, n, seedB);
+
+  comm.barrier();
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  summa(comm, q, nb, &localA[0], &localB[0], &localC[0]);
+  comm.barrier();
+  double duration = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+
+  vector<double> blocks(comm.rank() == 0 ? blockSize * ranks : 0);
+  comm.gather(&localC[0], blockSize, comm.rank() == 0 ? &blocks[0] : NULL, 0);
+  if (comm.rank() != 0) return;
+
+  cout<<"SUMMA on a "<<q<<"x"<<q<<" grid ("<<omp_get_max_threads()<<" threads per rank): "<<duration<<"ms"<<endl;
+
+  //the reference runs on rank 0 alone, with every thread of the machine, on the padded matrix
+  omp_set_num_threads(omp_get_num_procs());
+  int np = nb * q;
+  vector<double> a((long)np * np), b((long)np * np), trans((long)np * np), c((long)np * np, 0.0);
+  generateBlock(&a[0], 0, 0, np, n, seedA);
+  generateBlock(&b[0], 0, 0, np, n, seedB);
+  start = high_resolution_clock::now();
+  transposeBlock(&b[0], &trans[0], np);
+  mat_multiply_avx_add(&a[0], &trans[0], &c[0], np);
+  double single = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  cout<<"single process ("<<omp_get_max_threads()<<" threads): "<<single<<"ms"<<endl;
+
+  double maxDiff = 0;
+  for (int r = 0; r < ranks; r++)
+    for (int i = 0; i < nb; i++)
+      for (int j = 0; j < nb; j++) {
+        long gi = (long)(r / q) * nb + i, gj = (long)(r % q) * nb + j;
+        if (gi >= n || gj >= n) continue;
+        double ref = c[gi * np + gj];
+        maxDiff = max(maxDiff, fabs(ref - blocks[r * blockSize + (long)i * nb + j]) / ref);
+      }
+  cout<<"max relative difference = "<<maxDiff<<endl;
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 3) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> <grid_dim> [shm|socket]"<<endl;
+    return 1;
+  }
+  int n = atoi(argv[1]);
+  int q = atoi(argv[2]);
+  string transport = argc > 3 ? argv[3] : "shm";
+  if (n < 1 || q < 1 || (transport != "shm" && transport != "socket")) {
+    cout<<"the matrix size and grid dimension must be positive, the transport shm or socket"<<endl;
+    return 1;
+  }
+  int ranks = q * q;
+  int nb = ((n + q - 1) / q + 3) / 4 * 4;     //block side, rounded up to whole 4-column panels
+
+  //no OpenMP in the parent before the fork: every rank starts its own thread pool
+  int threads = max(1, (int)sysconf(_SC_NPROCESSORS_ONLN) / ranks);
+  pid_t parent = getpid();
+  void* segment = NULL;
+  size_t segmentBytes = 0;
+  vector<int> listeners;
+  if (transport == "shm") segment = ShmComm::create(ranks, segmentBytes);
+  else listeners = SocketComm::listen(ranks);
+
+  cout<<transport<<" transport, "<<ranks<<" ranks, "<<nb<<"x"<<nb<<" blocks"<<endl;
+  cout.flush();
+  vector<pid_t> children;
+  for (int r = 0; r < ranks; r++) {
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); exit(1); }
+    if (pid == 0) {
+      omp_set_num_threads(threads);
+      if (transport == "shm") {
+        ShmComm comm(r, ranks, segment);
+        worker(comm, n, q, nb);
+      } else {
+        SocketComm comm(r, ranks, listeners, parent);
+        worker(comm, n, q, nb);
+      }
+      cout.flush();
+      _exit(0);
+    }
+    children.push_back(pid);
+  }
+
+  int failed = 0;
+  for (pid_t pid : children) {
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+  }
+  if (transport == "shm") munmap(segment, segmentBytes);
+  else {
+    for (int fd : listeners) close(fd);
+    SocketComm::unlinkAll(ranks);
+  }
+  if (failed) cout<<failed<<" ranks failed"<<endl;
+  return failed ? 1 : 0;
+}
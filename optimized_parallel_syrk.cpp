@@ -0,0 +1,178 @@
+/**
+ * Parallel program to perform the symmetric rank-k update C = A * A^T (Gram matrix)
+ * computing only one triangle of C
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_syrk.cpp -o optimized_parallel_syrk
+ *  (run): ./optimized_parallel_syrk <matrix_size> [upper|lower] [nomirror]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define T 64     //tile size used to split C into triangle-aware work items
+
+enum Triangle { UPPER, LOWER, FULL };
+
+
+/*A method to initialize a matrix*/
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to populate a matrix with random values*/
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*A method to sum the 4 lanes of a 256 bit vector*/
+inline double reduce1(__m256d c){
+  double tempresult[4];
+  _mm256_storeu_pd(tempresult, c);
+  return tempresult[0]+tempresult[1]+tempresult[2]+tempresult[3];
+}
+
+/*A method to get the dot product of two rows of length size*/
+inline double dot(const double* a, const double* b, int size){
+  __m256d c0 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd();
+  int k = 0;
+  for (; k + 8 <= size; k += 8) {
+    c0 = _mm256_add_pd(c0, _mm256_mul_pd(_mm256_loadu_pd(&a[k]), _mm256_loadu_pd(&b[k])));
+    c1 = _mm256_add_pd(c1, _mm256_mul_pd(_mm256_loadu_pd(&a[k+4]), _mm256_loadu_pd(&b[k+4])));
+  }
+  double sum = reduce1(_mm256_add_pd(c0, c1));
+  for (; k < size; k++) {
+    sum += a[k]*b[k];
+  }
+  return sum;
+}
+
+/*
+ * A method to build the list of T x T tiles of C that touch the requested triangle.
+ * Every off-diagonal tile costs the same, diagonal tiles cost about half, so a static
+ * split of this list balances far better than a static split of the rows.
+ */
+vector<pair<int,int> > triangleTiles(int size, Triangle tri){
+  vector<pair<int,int> > tiles;
+  int blocks = (size + T - 1) / T;
+  for (int bi = 0; bi < blocks; bi++) {
+    for (int bj = 0; bj < blocks; bj++) {
+      if ((tri == UPPER && bj < bi) || (tri == LOWER && bj > bi))
+        continue;
+      tiles.push_back(make_pair(bi, bj));
+    }
+  }
+  return tiles;
+}
+
+/*
+ * A method to perform C = A * A^T. Since C[i][j] is the dot product of rows i and j of A,
+ * no transpose is needed. Only the tiles (and inside diagonal tiles only the elements)
+ * of the requested triangle are computed; mirror copies them to the other triangle.
+ */
+double syrk(double **matA, double **matC, int size, Triangle tri, bool mirror){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  vector<pair<int,int> > tiles = triangleTiles(size, tri);
+  int tileCount = tiles.size();
+
+  #pragma omp parallel for schedule(static, 1)
+  for (int t = 0; t < tileCount; t++) {
+    int i0 = tiles[t].first * T, i1 = min(i0 + T, size);
+    int j0 = tiles[t].second * T, j1 = min(j0 + T, size);
+    for (int i = i0; i < i1; i++) {
+      int jStart = j0, jEnd = j1;
+      if (tri == UPPER) jStart = max(j0, i);
+      if (tri == LOWER) jEnd = min(j1, i + 1);
+      for (int j = jStart; j < jEnd; j++) {
+        matC[i][j] = dot(matA[i], matA[j], size);
+      }
+    }
+  }
+
+  if (mirror && tri != FULL) {
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int i = 0; i < size; i++) {
+      for (int j = i + 1; j < size; j++) {
+        if (tri == UPPER) matC[j][i] = matC[i][j];
+        else              matC[i][j] = matC[j][i];
+      }
+    }
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;   //Get duration in milli seconds
+}
+
+/*A method that computes the Gram matrix of a random matrix with the full and the triangular kernels*/
+void matMultiply(int size, Triangle tri, bool mirror){
+  double** matA = initMat(size);    //Initialize matrix A
+  double** matFull = initMat(size); //All n*n outputs
+  double** matC = initMat(size);    //Only one triangle (plus the mirror)
+  populateMat(matA , size);
+
+  double full = syrk(matA, matFull, size, FULL, false);
+  double half = syrk(matA, matC, size, tri, mirror);
+
+  double maxDiff = 0;
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      bool computed = mirror || (tri == UPPER ? j >= i : j <= i);
+      if (computed) maxDiff = max(maxDiff, fabs(matFull[i][j] - matC[i][j]));
+    }
+  }
+
+  cout<<"full A*A^T:       "<<full<<"ms"<<endl;
+  cout<<(tri == UPPER ? "upper" : "lower")<<" triangle"<<(mirror ? " + mirror" : "")<<": "<<half<<"ms"<<endl;
+  cout<<"speedup = "<<full/half<<", max difference = "<<maxDiff<<endl;
+
+  freeMat(matA, size);
+  freeMat(matFull, size);
+  freeMat(matC, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [upper|lower] [nomirror]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  Triangle tri = (argc > 2 && strcmp(argv[2], "lower") == 0) ? LOWER : UPPER;
+  bool mirror = !(argc > 3 && strcmp(argv[3], "nomirror") == 0);
+  matMultiply(size, tri, mirror);
+  return 0;
+}
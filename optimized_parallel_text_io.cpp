@@ -0,0 +1,664 @@
+/**
+ * Parallel program to read and write matrices as CSV (dense) and Matrix Market (coordinate
+ * into CSR, array into dense) files, splitting mmap'ed files at line boundaries across threads
+ *
+ * To run this program:
+ *  (compile): g++ -std=c++11 -fopenmp optimized_parallel_text_io.cpp -o optimized_parallel_text_io
+ *  (run): ./optimized_parallel_text_io <matrix_size> [density] [directory]
+ *         ./optimized_parallel_text_io read <file.csv|file.mtx>
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+/*A sparse matrix in compressed sparse row format*/
+struct CSRMatrix {
+  int rows, cols;
+  vector<int> rowPtr;     //row i holds entries rowPtr[i] .. rowPtr[i+1]-1
+  vector<int> colIdx;
+  vector<double> values;
+};
+
+/*The symmetry field of a Matrix Market banner; the symmetric kinds store only the lower triangle*/
+enum Symmetry { GENERAL, SYMMETRIC, SKEW_SYMMETRIC };
+
+/*A read-only mapping of a whole text file*/
+struct TextFile {
+  const char* data;
+  size_t length;
+};
+
+
+/*A method to initialize a rows x cols matrix*/
+double** initMat(int rows, int cols){
+  double** mat = new double*[rows];
+  for (int i = 0; i < rows; i++) {
+    mat[i] = new double[cols]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int rows){
+  for (int i = 0; i < rows; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to map a file for reading*/
+TextFile mapFile(const string& path){
+  TextFile f;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) { perror(path.c_str()); exit(1); }
+  struct stat st;
+  fstat(fd, &st);
+  f.length = st.st_size;
+  f.data = (const char*)mmap(NULL, max(f.length, (size_t)1), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (f.data == MAP_FAILED) { perror("mmap"); exit(1); }
+  madvise((void*)f.data, f.length, MADV_SEQUENTIAL);
+  return f;
+}
+
+/*A method to unmap a file*/
+void unmapFile(TextFile& f){
+  munmap((void*)f.data, max(f.length, (size_t)1));
+}
+
+/*
+ * A method to parse a decimal number at p. When the significand has at most 19 digits and is
+ * below 2^53 and the decimal exponent is within +-22, one exact multiply or divide by a power
+ * of ten gives the correctly rounded result; anything else falls back to strtod.
+ * Returns the position after the number, or p when there is none.
+ */
+const char* parseDouble(const char* p, const char* end, double& out){
+  static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+  const char* start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+  unsigned long long mantissa = 0;
+  int digits = 0, exp10 = 0;
+  bool any = false;
+  for (; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+    if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; }
+    else exp10++;
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+      if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; exp10--; }
+    }
+  }
+  if (!any) {   //not a plain decimal (inf, nan, hex ...): let strtod decide
+    char buf[64];
+    size_t n = 0;
+    while (start + n < end && n < sizeof(buf) - 1 && start[n] != ',' && start[n] != '\n' && start[n] != ' ') { buf[n] = start[n]; n++; }
+    buf[n] = 0;
+    char* stop;
+    out = strtod(buf, &stop);
+    return start + (stop - buf);
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool expNegative = false;
+    if (q < end && (*q == '-' || *q == '+')) expNegative = *q++ == '-';
+    if (q < end && *q >= '0' && *q <= '9') {
+      int e = 0;
+      for (; q < end && *q >= '0' && *q <= '9'; q++) if (e < 100000) e = e * 10 + (*q - '0');
+      exp10 += expNegative ? -e : e;
+      p = q;
+    }
+  }
+
+  if (digits <= 19 && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+    double v = (double)mantissa;
+    v = exp10 < 0 ? v / pow10[-exp10] : v * pow10[exp10];
+    out = negative ? -v : v;
+    return p;
+  }
+  char buf[128];
+  size_t n = min((size_t)(p - start), sizeof(buf) - 1);
+  memcpy(buf, start, n);
+  buf[n] = 0;
+  out = strtod(buf, NULL);
+  return p;
+}
+
+/*A method to parse a non negative integer at p without reading past end*/
+const char* parseLong(const char* p, const char* end, long& out){
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+  out = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++) out = out * 10 + (*p - '0');
+  return p;
+}
+
+/*
+ * A method to split [begin, end) into one chunk per thread, every chunk starting at the
+ * beginning of a line, and to count the data lines of each chunk (skipping blank lines and
+ * lines starting with the comment character). starts has threads+1 entries.
+ */
+void splitLines(const char* begin, const char* end, int threads, char comment, vector<const char*>& starts, vector<long>& lines){
+  starts.assign(threads + 1, end);
+  lines.assign(threads + 1, 0);
+  starts[0] = begin;
+  size_t length = end - begin;
+  for (int t = 1; t < threads; t++) {
+    const char* p = begin + length * t / threads;
+    if (p < starts[t-1]) p = starts[t-1];
+    const char* nl = p > begin ? (const char*)memchr(p - 1, '\n', end - (p - 1)) : begin - 1;
+    starts[t] = nl ? nl + 1 : end;
+  }
+
+  #pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; t++) {
+    long count = 0;
+    for (const char* p = starts[t]; p < starts[t+1]; ) {
+      const char* nl = (const char*)memchr(p, '\n', starts[t+1] - p);
+      const char* eol = nl ? nl : starts[t+1];
+      if (eol > p && *p != comment && !(eol - p == 1 && *p == '\r')) count++;
+      p = eol + 1;
+    }
+    lines[t+1] = count;
+  }
+  for (int t = 0; t < threads; t++) lines[t+1] += lines[t];    //prefix: first data line of each chunk
+}
+
+/*
+ * A method to read a dense CSV file into a matrix; rows and cols are set from the file, cols
+ * from the first data line. A row with a different number of fields is an error.
+ */
+double** readCSV(const string& path, int& rows, int& cols){
+  TextFile f = mapFile(path);
+  const char* end = f.data + f.length;
+  int threads = omp_get_max_threads();
+  vector<const char*> starts;
+  vector<long> lines;
+  splitLines(f.data, end, threads, '#', starts, lines);
+  rows = lines[threads];
+
+  cols = 0;   //count the fields of the first line that is not blank or a comment
+  for (const char* p = f.data; p < end && rows > 0; ) {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    const char* eol = nl ? nl : end;
+    if (eol > p && *p != '#' && !(eol - p == 1 && *p == '\r')) {
+      cols = 1;
+      for (const char* q = p; q < eol; q++) cols += *q == ',';
+      break;
+    }
+    p = eol + 1;
+  }
+
+  double** mat = initMat(rows, cols);
+  vector<long> bad(threads, -1);    //first row of each chunk without exactly cols fields
+  #pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; t++) {
+    long row = lines[t];
+    for (const char* p = starts[t]; p < starts[t+1]; ) {
+      const char* nl = (const char*)memchr(p, '\n', starts[t+1] - p);
+      const char* eol = nl ? nl : starts[t+1];
+      if (eol > p && *p != '#' && !(eol - p == 1 && *p == '\r')) {
+        const char* q = p;
+        int c = 0;
+        for (; c < cols && q < eol; c++) {
+          q = parseDouble(q, eol, mat[row][c]);
+          while (q < eol && *q != ',') q++;
+          q++;
+        }
+        if ((c < cols || q <= eol) && bad[t] < 0) bad[t] = row;   //q <= eol: a comma after the last field
+        row++;
+      }
+      p = eol + 1;
+    }
+  }
+  unmapFile(f);
+  for (int t = 0; t < threads; t++) {
+    if (bad[t] >= 0) {
+      cerr<<path<<": data row "<<bad[t] + 1<<" does not have "<<cols<<" fields like the first"<<endl;
+      exit(1);
+    }
+  }
+  return mat;
+}
+
+/*A method to parse the Matrix Market banner and size line; returns the position of the first data line*/
+const char* readMMHeader(const TextFile& f, bool& coordinate, Symmetry& symmetry, bool& pattern, long& rows, long& cols, long& entries){
+  const char* end = f.data + f.length;
+  const char* p = f.data;
+  const char* nl = (const char*)memchr(p, '\n', end - p);
+  string banner(p, nl ? nl : end);
+  for (size_t c = 0; c < banner.size(); c++) banner[c] = tolower(banner[c]);
+  istringstream fields(banner);
+  string head, object, format, field, sym;
+  fields>>head>>object>>format>>field>>sym;
+  if (head != "%%matrixmarket" || object != "matrix") { cerr<<"missing %%MatrixMarket matrix banner"<<endl; exit(1); }
+  if (format != "coordinate" && format != "array") { cerr<<"unknown format "<<format<<endl; exit(1); }
+  if (field == "complex") { cerr<<"complex matrices are not supported"<<endl; exit(1); }
+  if (field != "real" && field != "integer" && field != "double" && field != "pattern") { cerr<<"unknown field "<<field<<endl; exit(1); }
+  if (sym == "general") symmetry = GENERAL;
+  else if (sym == "symmetric") symmetry = SYMMETRIC;
+  else if (sym == "skew-symmetric") symmetry = SKEW_SYMMETRIC;
+  else { cerr<<"symmetry "<<(sym.empty() ? "(missing)" : sym)<<" is not supported"<<endl; exit(1); }    //hermitian needs complex values
+  coordinate = format == "coordinate";
+  pattern = field == "pattern";
+  if (pattern && !coordinate) { cerr<<"pattern array files are not valid"<<endl; exit(1); }
+
+  while (nl && nl + 1 < end && nl[1] == '%') nl = (const char*)memchr(nl + 1, '\n', end - nl - 1);   //skip comments
+  if (!nl) { cerr<<"missing size line"<<endl; exit(1); }
+  const char* q = parseLong(nl + 1, end, rows);
+  q = parseLong(q, end, cols);
+  if (coordinate) q = parseLong(q, end, entries);
+  else entries = rows * cols;
+  if (symmetry != GENERAL && rows != cols) { cerr<<"a symmetric matrix must be square"<<endl; exit(1); }
+  nl = (const char*)memchr(q, '\n', end - q);
+  return nl ? nl + 1 : end;
+}
+
+/*
+ * A method to read a Matrix Market coordinate file into CSR. Entries are parsed in parallel
+ * into triplet arrays at the offset given by the line counts, then bucketed by row with a
+ * counting sort, also in parallel: every chunk counts its entries per row, and a prefix sum
+ * over rows and chunks gives each chunk its own slots. Rows are then ordered by column.
+ * Symmetric and skew-symmetric files are expanded, the mirrored entries of a skew-symmetric
+ * one negated. Indices outside the matrix and an entry count other than the size line's are
+ * errors.
+ */
+CSRMatrix readMMCoordinate(const TextFile& f, const char* data, Symmetry symmetry, bool pattern, long rows, long cols, long entries){
+  const char* end = f.data + f.length;
+  int threads = omp_get_max_threads();
+  vector<const char*> starts;
+  vector<long> lines;
+  splitLines(data, end, threads, '%', starts, lines);
+  if (lines[threads] != entries) {
+    cerr<<"the size line announces "<<entries<<" entries but the file has "<<lines[threads]<<endl;
+    exit(1);
+  }
+
+  vector<int> ri(entries), ci(entries);
+  vector<double> vi(entries);
+  vector<long> bad(threads, -1);    //first entry of each chunk with an index out of range
+  #pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; t++) {
+    long e = lines[t];
+    for (const char* p = starts[t]; p < starts[t+1]; ) {
+      const char* nl = (const char*)memchr(p, '\n', starts[t+1] - p);
+      const char* eol = nl ? nl : starts[t+1];
+      if (eol > p && *p != '%' && !(eol - p == 1 && *p == '\r')) {
+        long r, c;
+        const char* q = parseLong(p, eol, r);
+        q = parseLong(q, eol, c);
+        if ((r < 1 || r > rows || c < 1 || c > cols) && bad[t] < 0) bad[t] = e;
+        ri[e] = r - 1;
+        ci[e] = c - 1;
+        if (pattern) vi[e] = 1;
+        else parseDouble(q, eol, vi[e]);
+        e++;
+      }
+      p = eol + 1;
+    }
+  }
+
+  for (int t = 0; t < threads; t++) {
+    if (bad[t] >= 0) {
+      cerr<<"entry "<<bad[t] + 1<<" is outside the "<<rows<<"x"<<cols<<" matrix (indices are 1-based)"<<endl;
+      exit(1);
+    }
+  }
+
+  bool mirror = symmetry != GENERAL;
+  double mirrorSign = symmetry == SKEW_SYMMETRIC ? -1 : 1;
+  CSRMatrix csr;
+  csr.rows = rows;
+  csr.cols = cols;
+  csr.rowPtr.assign(rows + 1, 0);
+  vector<vector<int> > fill(threads);     //per chunk: its entries in each row, then its first slot in each row
+  #pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; t++) {
+    fill[t].assign(rows, 0);
+    for (long e = lines[t]; e < lines[t+1]; e++) {
+      fill[t][ri[e]]++;
+      if (mirror && ri[e] != ci[e]) fill[t][ci[e]]++;
+    }
+  }
+  #pragma omp parallel for schedule(static)
+  for (long r = 0; r < rows; r++) {
+    int count = 0;
+    for (int t = 0; t < threads; t++) count += fill[t][r];
+    csr.rowPtr[r+1] = count;
+  }
+  for (long r = 0; r < rows; r++) csr.rowPtr[r+1] += csr.rowPtr[r];
+  #pragma omp parallel for schedule(static)
+  for (long r = 0; r < rows; r++) {
+    int slot = csr.rowPtr[r];
+    for (int t = 0; t < threads; t++) {
+      int count = fill[t][r];
+      fill[t][r] = slot;
+      slot += count;
+    }
+  }
+
+  csr.colIdx.resize(csr.rowPtr[rows]);
+  csr.values.resize(csr.rowPtr[rows]);
+  #pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; t++) {
+    vector<int>& next = fill[t];
+    for (long e = lines[t]; e < lines[t+1]; e++) {
+      int p = next[ri[e]]++;
+      csr.colIdx[p] = ci[e];
+      csr.values[p] = vi[e];
+      if (mirror && ri[e] != ci[e]) {
+        p = next[ci[e]]++;
+        csr.colIdx[p] = ri[e];
+        csr.values[p] = mirrorSign * vi[e];
+      }
+    }
+  }
+
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (long r = 0; r < rows; r++) {
+    int b = csr.rowPtr[r], e = csr.rowPtr[r+1];
+    vector<pair<int,double> > row(e - b);
+    for (int p = b; p < e; p++) row[p - b] = make_pair(csr.colIdx[p], csr.values[p]);
+    sort(row.begin(), row.end());
+    for (int p = b; p < e; p++) { csr.colIdx[p] = row[p - b].first; csr.values[p] = row[p - b].second; }
+  }
+  return csr;
+}
+
+/*
+ * A method to read a Matrix Market array (column-major dense) file into a matrix. A symmetric
+ * file holds the lower triangle column by column, a skew-symmetric one the part below the
+ * diagonal; the values are parsed in parallel and the triangle then expanded column by column.
+ */
+double** readMMArray(const TextFile& f, const char* data, Symmetry symmetry, long rows, long cols){
+  const char* end = f.data + f.length;
+  int threads = omp_get_max_threads();
+  vector<const char*> starts;
+  vector<long> lines;
+  splitLines(data, end, threads, '%', starts, lines);
+  long skip = symmetry == SKEW_SYMMETRIC ? 1 : 0;     //the diagonal is not stored, it is zero
+  long stored = symmetry == GENERAL ? rows * cols : rows * (rows + 1) / 2 - skip * rows;
+  if (lines[threads] != stored) {
+    cerr<<"a "<<rows<<"x"<<cols<<" array file of this symmetry has "<<stored<<" values, this one "<<lines[threads]<<endl;
+    exit(1);
+  }
+
+  double** mat = initMat(rows, cols);
+  if (symmetry == GENERAL) {
+    #pragma omp parallel for num_threads(threads)
+    for (int t = 0; t < threads; t++) {
+      long e = lines[t];
+      for (const char* p = starts[t]; p < starts[t+1]; ) {
+        const char* nl = (const char*)memchr(p, '\n', starts[t+1] - p);
+        const char* eol = nl ? nl : starts[t+1];
+        if (eol > p && *p != '%' && !(eol - p == 1 && *p == '\r')) {
+          parseDouble(p, eol, mat[e % rows][e / rows]);
+          e++;
+        }
+        p = eol + 1;
+      }
+    }
+    return mat;
+  }
+
+  vector<double> values(stored, 0.0);
+  #pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; t++) {
+    long e = lines[t];
+    for (const char* p = starts[t]; p < starts[t+1]; ) {
+      const char* nl = (const char*)memchr(p, '\n', starts[t+1] - p);
+      const char* eol = nl ? nl : starts[t+1];
+      if (eol > p && *p != '%' && !(eol - p == 1 && *p == '\r')) {
+        parseDouble(p, eol, values[e]);
+        e++;
+      }
+      p = eol + 1;
+    }
+  }
+
+  double sign = skip ? -1 : 1;
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (long c = 0; c < cols; c++) {
+    const double* v = &values[c * rows - c * (c - 1) / 2 - skip * c];   //column c holds rows c+skip .. rows-1
+    for (long r = c + skip; r < rows; r++, v++) {
+      mat[r][c] = *v;
+      mat[c][r] = r == c ? *v : sign * *v;
+    }
+  }
+  return mat;
+}
+
+/*
+ * A method to write text produced in parallel: every thread formats its share of the rows
+ * into its own buffer, the buffer offsets are a prefix sum of their sizes, and every thread
+ * then writes its buffer at its offset.
+ */
+template <typename FormatRows>
+size_t writeParallel(const string& path, const string& header, long rows, FormatRows format){
+  int threads = omp_get_max_threads();
+  vector<string> parts(threads);
+  #pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; t++) {
+    format(rows * t / threads, rows * (t + 1) / threads, parts[t]);
+  }
+  vector<size_t> offsets(threads + 1, header.size());
+  for (int t = 0; t < threads; t++) offsets[t+1] = offsets[t] + parts[t].size();
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, offsets[threads]) != 0) { perror(path.c_str()); exit(1); }
+  bool ok = pwrite(fd, header.data(), header.size(), 0) == (ssize_t)header.size();
+  #pragma omp parallel for num_threads(threads) reduction(&&:ok)
+  for (int t = 0; t < threads; t++) {
+    ok = ok && pwrite(fd, parts[t].data(), parts[t].size(), offsets[t]) == (ssize_t)parts[t].size();
+  }
+  close(fd);
+  if (!ok) { perror("pwrite"); exit(1); }
+  return offsets[threads];
+}
+
+/*
+ * A method to append the shortest of the %.15g, %.16g and %.17g forms of v that reads back as
+ * v. Short forms keep files small and let the reader take its exact fast path.
+ */
+inline void appendDouble(string& out, double v){
+  char buf[32];
+  int n = 0;
+  for (int precision = 15; precision <= 17; precision++) {
+    n = snprintf(buf, sizeof(buf), "%.*g", precision, v);
+    if (precision == 17 || strtod(buf, NULL) == v) break;
+  }
+  out.append(buf, n);
+}
+
+/*A method to write a dense matrix as CSV*/
+size_t writeCSV(const string& path, double** mat, int rows, int cols){
+  return writeParallel(path, "", rows, [&](long r0, long r1, string& out) {
+    for (long r = r0; r < r1; r++) {
+      for (int c = 0; c < cols; c++) {
+        if (c) out += ',';
+        appendDouble(out, mat[r][c]);
+      }
+      out += '\n';
+    }
+  });
+}
+
+/*A method to write a CSR matrix as a Matrix Market coordinate file*/
+size_t writeMM(const string& path, const CSRMatrix& csr){
+  char size[96];
+  snprintf(size, sizeof(size), "%d %d %d\n", csr.rows, csr.cols, csr.rowPtr[csr.rows]);
+  string header = string("%%MatrixMarket matrix coordinate real general\n") + size;
+  return writeParallel(path, header, csr.rows, [&](long r0, long r1, string& out) {
+    char buf[32];
+    for (long r = r0; r < r1; r++) {
+      for (int p = csr.rowPtr[r]; p < csr.rowPtr[r+1]; p++) {
+        out.append(buf, snprintf(buf, sizeof(buf), "%ld %d ", r + 1, csr.colIdx[p] + 1));
+        appendDouble(out, csr.values[p]);
+        out += '\n';
+      }
+    }
+  });
+}
+
+/*A method to read a CSV file the naive way, one strtod at a time on one thread, for comparison*/
+double** readCSVNaive(const string& path, int rows, int cols){
+  FILE* fp = fopen(path.c_str(), "r");
+  double** mat = initMat(rows, cols);
+  for (int r = 0; r < rows; r++)
+    for (int c = 0; c < cols; c++)
+      if (fscanf(fp, "%lf,", &mat[r][c]) != 1) { cerr<<"short CSV file"<<endl; exit(1); }
+  fclose(fp);
+  return mat;
+}
+
+/*A method to get the size of a file in MB*/
+double fileMB(const string& path){
+  struct stat st;
+  stat(path.c_str(), &st);
+  return (double)st.st_size / (1 << 20);
+}
+
+/*A method to get the milliseconds since start*/
+double msSince(high_resolution_clock::time_point start){
+  return (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+}
+
+/*A method to read any supported file and report the throughput*/
+void readFile(const string& path){
+  high_resolution_clock::time_point start = high_resolution_clock::now();
+  if (path.size() > 4 && path.compare(path.size() - 4, 4, ".csv") == 0) {
+    int rows, cols;
+    double** mat = readCSV(path, rows, cols);
+    double ms = msSince(start);
+    cout<<path<<": "<<rows<<"x"<<cols<<" dense, "<<ms<<"ms, "<<fileMB(path) / (ms / 1000)<<" MB/s"<<endl;
+    freeMat(mat, rows);
+    return;
+  }
+  TextFile f = mapFile(path);
+  bool coordinate, pattern;
+  Symmetry symmetry;
+  long rows, cols, entries;
+  const char* data = readMMHeader(f, coordinate, symmetry, pattern, rows, cols, entries);
+  if (coordinate) {
+    CSRMatrix csr = readMMCoordinate(f, data, symmetry, pattern, rows, cols, entries);
+    double ms = msSince(start);
+    cout<<path<<": "<<rows<<"x"<<cols<<" CSR with "<<csr.rowPtr[rows]<<" non zeros, "<<ms<<"ms, "<<fileMB(path) / (ms / 1000)<<" MB/s"<<endl;
+  }
+  else {
+    double** mat = readMMArray(f, data, symmetry, rows, cols);
+    double ms = msSince(start);
+    cout<<path<<": "<<rows<<"x"<<cols<<" dense, "<<ms<<"ms, "<<fileMB(path) / (ms / 1000)<<" MB/s"<<endl;
+    freeMat(mat, rows);
+  }
+  unmapFile(f);
+}
+
+/*A method that writes and reads back random dense and sparse matrices, reporting MB/s for each step*/
+void roundTrip(int size, double density, const string& dir){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(-8,8);
+  std::uniform_real_distribution<> keep(0,1);
+
+  double** dense = initMat(size, size);   //6 decimals, like typical exported data
+  for (int r = 0; r < size; r++)
+    for (int c = 0; c < size; c++) dense[r][c] = round(dis(gen) * 1e6) / 1e6;
+
+  string csvPath = dir + "/text_io_dense.csv";
+  high_resolution_clock::time_point start = high_resolution_clock::now();
+  writeCSV(csvPath, dense, size, size);
+  double writeMs = msSince(start);
+  double mb = fileMB(csvPath);
+
+  start = high_resolution_clock::now();
+  int rows, cols;
+  double** back = readCSV(csvPath, rows, cols);
+  double readMs = msSince(start);
+
+  start = high_resolution_clock::now();
+  double** naive = readCSVNaive(csvPath, size, size);
+  double naiveMs = msSince(start);
+
+  long mismatches = (rows != size || cols != size) ? 1 : 0;
+  for (int r = 0; r < size && !mismatches; r++)
+    for (int c = 0; c < size; c++) mismatches += back[r][c] != dense[r][c] || back[r][c] != naive[r][c];
+
+  cout<<"CSV "<<mb<<" MB: parallel write "<<mb / (writeMs / 1000)<<" MB/s, parallel read "<<mb / (readMs / 1000)
+      <<" MB/s, single thread fscanf read "<<mb / (naiveMs / 1000)<<" MB/s, values not read back exactly = "<<mismatches<<endl;
+
+  CSRMatrix csr;
+  csr.rows = csr.cols = size;
+  csr.rowPtr.assign(size + 1, 0);
+  for (int r = 0; r < size; r++) {
+    for (int c = 0; c < size; c++) {
+      if (keep(gen) < density) { csr.colIdx.push_back(c); csr.values.push_back(dis(gen)); }
+    }
+    csr.rowPtr[r+1] = csr.colIdx.size();
+  }
+
+  string mmPath = dir + "/text_io_sparse.mtx";
+  start = high_resolution_clock::now();
+  writeMM(mmPath, csr);
+  writeMs = msSince(start);
+  mb = fileMB(mmPath);
+
+  start = high_resolution_clock::now();
+  TextFile f = mapFile(mmPath);
+  bool coordinate, pattern;
+  Symmetry symmetry;
+  long mmRows, mmCols, entries;
+  const char* data = readMMHeader(f, coordinate, symmetry, pattern, mmRows, mmCols, entries);
+  CSRMatrix csrBack = readMMCoordinate(f, data, symmetry, pattern, mmRows, mmCols, entries);
+  readMs = msSince(start);
+  unmapFile(f);
+
+  bool same = csrBack.rowPtr == csr.rowPtr && csrBack.colIdx == csr.colIdx && csrBack.values == csr.values;
+  cout<<"Matrix Market "<<mb<<" MB ("<<csr.rowPtr[size]<<" non zeros): parallel write "<<mb / (writeMs / 1000)
+      <<" MB/s, parallel read into CSR "<<mb / (readMs / 1000)<<" MB/s, identical after round trip = "<<(same ? "yes" : "no")<<endl;
+
+  unlink(csvPath.c_str());
+  unlink(mmPath.c_str());
+  freeMat(dense, size);
+  freeMat(back, rows);
+  freeMat(naive, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc > 2 && strcmp(argv[1], "read") == 0) {
+    readFile(argv[2]);
+    return 0;
+  }
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [density] [directory]"<<endl;
+    cout<<"       "<<argv[0]<<" read <file.csv|file.mtx>"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  double density = argc > 2 ? atof(argv[2]) : 0.01;
+  string dir = argc > 3 ? argv[3] : "/tmp";
+  roundTrip(size, density, dir);
+  return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * Parallel program to perform triangular matrix-matrix multiplication C = A * B
+ * where A is lower or upper triangular, skipping the zero half of A
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_trmm.cpp -o optimized_parallel_trmm
+ *  (run): ./optimized_parallel_trmm <matrix_size> [lower|upper]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+enum Triangle { UPPER, LOWER, FULL };
+
+
+/*A method to initialize a matrix*/
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+/*A method to free the memory allocated for a matrix*/
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+/*A method to get the transpose matrix of a given matrix*/
+double** getTranspose(double** matrix, int size){
+  for (int row = 0; row < size; row++) {
+    for (int col = row+1; col < size; col++) {
+      std::swap(matrix[row][col], matrix[col][row]);
+    }
+  }
+  return matrix;
+}
+
+/*A method to populate a matrix with random values*/
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*A method to zero the half of a matrix outside the given triangle*/
+void makeTriangular(double** matrix, int size, Triangle tri){
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      if ((tri == LOWER && col > row) || (tri == UPPER && col < row))
+        matrix[row][col] = 0;
+    }
+  }
+}
+
+/*A method to sum the 4 lanes of a 256 bit vector*/
+inline double reduce1(__m256d c){
+  double tempresult[4];
+  _mm256_storeu_pd(tempresult, c);
+  return tempresult[0]+tempresult[1]+tempresult[2]+tempresult[3];
+}
+
+/*A method to get the dot product of a[k0..k1) and b[k0..k1)*/
+inline double dot(const double* a, const double* b, int k0, int k1){
+  __m256d c0 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd();
+  int k = k0;
+  for (; k + 8 <= k1; k += 8) {
+    c0 = _mm256_add_pd(c0, _mm256_mul_pd(_mm256_loadu_pd(&a[k]), _mm256_loadu_pd(&b[k])));
+    c1 = _mm256_add_pd(c1, _mm256_mul_pd(_mm256_loadu_pd(&a[k+4]), _mm256_loadu_pd(&b[k+4])));
+  }
+  double sum = reduce1(_mm256_add_pd(c0, c1));
+  for (; k < k1; k++) {
+    sum += a[k]*b[k];
+  }
+  return sum;
+}
+
+/*A method to get the non zero k range of row i of a triangular matrix*/
+inline void kRange(int i, int size, Triangle tri, int& k0, int& k1){
+  k0 = (tri == UPPER) ? i : 0;
+  k1 = (tri == LOWER) ? i + 1 : size;
+}
+
+/*
+ * A method to split the rows into one contiguous range per thread so that every range
+ * holds about the same number of multiply-adds. Row i of a lower triangular matrix costs
+ * i+1, so an even split of the rows would give the last thread almost twice the average.
+ */
+vector<int> balancedRows(int size, Triangle tri, int threads){
+  vector<int> bounds(threads + 1, size);
+  bounds[0] = 0;
+  long total = 0;
+  for (int i = 0; i < size; i++) {
+    int k0, k1;
+    kRange(i, size, tri, k0, k1);
+    total += k1 - k0;
+  }
+  long done = 0;
+  int t = 1;
+  for (int i = 0; i < size && t < threads; i++) {
+    int k0, k1;
+    kRange(i, size, tri, k0, k1);
+    done += k1 - k0;
+    while (t < threads && done * threads >= total * t) {
+      bounds[t++] = i + 1;
+    }
+  }
+  return bounds;
+}
+
+/*A method to perform C = A * B with A triangular; the k loop of every row stops at the diagonal*/
+double trmm(double **matA, double **trans_matB, double **matC, int size, Triangle tri){
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+
+  int threads = omp_get_max_threads();
+  vector<int> bounds = balancedRows(size, tri, threads);
+
+  //one range per iteration, so every range is computed whatever team the runtime gives
+  #pragma omp parallel for schedule(static,1)
+  for (int t = 0; t < threads; t++) {
+    for (int i = bounds[t]; i < bounds[t+1]; i++) {
+      int k0, k1;
+      kRange(i, size, tri, k0, k1);
+      for (int j = 0; j < size; j++) {
+        matC[i][j] = dot(matA[i], trans_matB[j], k0, k1);
+      }
+    }
+  }
+
+  high_resolution_clock::time_point end = high_resolution_clock::now(); //End clock
+
+  return (double)duration_cast<nanoseconds>( end - start ).count()/1000000;   //Get duration in milli seconds
+}
+
+/*A method that multiplies a random triangular matrix by a random matrix with the dense and the triangular kernels*/
+void matMultiply(int size, Triangle tri){
+  double** matA = initMat(size);    //Initialize matrix A
+  double** matB = initMat(size);    //Initialize matrix B
+  double** matFull = initMat(size); //Result walking the full k range
+  double** matC = initMat(size);    //Result of the triangular kernel
+  populateMat(matA , size);
+  populateMat(matB, size);
+  makeTriangular(matA, size, tri);
+
+  double** trans_matB = getTranspose(matB,size);
+
+  double full = trmm(matA, trans_matB, matFull, size, FULL);
+  double half = trmm(matA, trans_matB, matC, size, tri);
+
+  double maxDiff = 0;
+  for (int i = 0; i < size; i++)
+    for (int j = 0; j < size; j++)
+      maxDiff = max(maxDiff, fabs(matFull[i][j] - matC[i][j]));
+
+  cout<<"dense multiply:      "<<full<<"ms"<<endl;
+  cout<<(tri == LOWER ? "lower" : "upper")<<" triangular multiply: "<<half<<"ms"<<endl;
+  cout<<"speedup = "<<full/half<<", max difference = "<<maxDiff<<endl;
+
+  freeMat(matA, size);
+  freeMat(matB, size);
+  freeMat(matFull, size);
+  freeMat(matC, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [lower|upper]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  Triangle tri = (argc > 2 && strcmp(argv[2], "upper") == 0) ? UPPER : LOWER;
+  matMultiply(size, tri);
+  return 0;
+}
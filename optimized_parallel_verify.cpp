@@ -0,0 +1,288 @@
+/**
+ * Parallel program to verify the results of the SIMD kernels with Freivalds' algorithm
+ *
+ * Instead of recomputing C with the naive multiply, C = A * B is checked as C * R = A * (B * R)
+ * for a random size x trials matrix R: three matrix-vector style products, O(trials * n^2).
+ * Floating point C is never exact, so each entry is compared against a bound scaled by
+ * |A| * (|B| * |R|), computed in the same sweep. The bound grows with sqrt(size), like
+ * rounding errors that do not all go the same way, rather than with the worst case size; a
+ * single entry of a 1000 x 1000 C that is off by about 1e-10 relative is caught. Any larger
+ * error passes only with negligible probability, and each extra trial cuts that further.
+ *
+ * To run this program:
+ *  (compile): g++ -mavx -std=c++11 -fopenmp optimized_parallel_verify.cpp -o optimized_parallel_verify
+ *  (run): ./optimized_parallel_verify <matrix_size> [avx|sse] [trials]
+ *
+ *
+ */
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <omp.h>
+#include <x86intrin.h>
+
+
+using namespace std::chrono;
+using namespace std;
+
+#define TOLERANCE 16        //allowed error, in units of sqrt(size) * DBL_EPSILON * (|A| * |B| * |R|)
+
+/*The outcome of a verification*/
+struct Verification {
+  bool ok;
+  long badEntries;      //entries of C * R outside the bound
+  int firstBadRow;
+  double worst;         //largest |C*R - A*B*R| relative to its bound
+};
+
+
+double** initMat(int size){
+  double** mat = new double*[size];
+  for (int i = 0; i < size; i++) {
+    mat[i] = new double[size]();
+  }
+  return mat;
+}
+
+void freeMat(double** mat, int size){
+  for (int i = 0; i < size; i++) {
+    delete[] mat[i];
+  }
+  delete[] mat;
+}
+
+double** getTranspose(double** matrix, int size){
+  for (int row = 0; row < size; row++) {
+    for (int col = row+1; col < size; col++) {
+      std::swap(matrix[row][col], matrix[col][row]);
+    }
+  }
+  return matrix;
+}
+
+void populateMat(double** matrix, int size){
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> dis(0,8);//The distribution in range 1-8
+
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      matrix[row][col] = dis(gen);
+    }
+  }
+}
+
+/*The kernel of optimized_parallel_avx.cpp, writing into matC; B is transposed in place and back*/
+void mat_multiply_avx(double **matA, double **matB, double **matC, int size){
+  double** trans_matB = getTranspose(matB, size);
+  int kEnd = size - size % 4;
+
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      __m256d c = _mm256_setzero_pd();
+      double tempresult[4];
+      for (int k = 0; k < kEnd; k += 4) {
+        c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_loadu_pd(&matA[i][k]), _mm256_loadu_pd(&trans_matB[j][k])));
+      }
+      _mm256_storeu_pd(tempresult, c);
+      double sum = tempresult[0]+tempresult[1]+tempresult[2]+tempresult[3];
+      for (int k = kEnd; k < size; k++) sum += matA[i][k] * trans_matB[j][k];
+      matC[i][j] = sum;
+    }
+  }
+
+  getTranspose(matB, size);
+}
+
+/*The SSE kernel of optimized_parallel_new.cpp, writing into matC; B is transposed in place and back*/
+void mat_multiply_compiler_intrinsics(double **matA, double **matB, double **matC, int size){
+  double** trans_matB = getTranspose(matB, size);
+  int kEnd = size - size % 2;
+
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      __m128d c = _mm_setzero_pd();
+      for (int k = 0; k < kEnd; k += 2) {
+        c = _mm_add_pd(c, _mm_mul_pd(_mm_loadu_pd(&matA[i][k]), _mm_loadu_pd(&trans_matB[j][k])));
+      }
+      c = _mm_hadd_pd(c, c);
+      double sum;
+      _mm_store_sd(&sum, c);
+      if (kEnd < size) sum += matA[i][kEnd] * trans_matB[j][kEnd];
+      matC[i][j] = sum;
+    }
+  }
+
+  getTranspose(matB, size);
+}
+
+/*The naive multiply of sequential.cpp, the check this replaces*/
+void multiply(double **matA, double **matB, double **matC, int size){
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      double sum = 0;
+      for (int k = 0; k < size; k++) {
+        sum += matA[i][k] * matB[k][j];
+      }
+      matC[i][j] = sum;
+    }
+  }
+}
+
+/*
+ * A method to check C = A * B with Freivalds' algorithm, all trials at once. R has random signs
+ * and magnitudes in [0.5, 1.5). One parallel sweep over B gives Y = B * R and Ya = |B| * |R|,
+ * one over A and C gives Z = A * Y, Za = |A| * Ya and W = C * R. Entry (i,t) passes if
+ * |W - Z| <= TOLERANCE * sqrt(size) * eps * Za.
+ */
+Verification freivalds(double **matA, double **matB, double **matC, int size, int trials, unsigned seed){
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<> magnitude(0.5, 1.5);
+  vector<double> r((long)size * trials), y((long)size * trials), ya((long)size * trials);
+  for (long e = 0; e < (long)size * trials; e++) r[e] = (gen() & 1 ? 1 : -1) * magnitude(gen);
+
+  #pragma omp parallel for schedule(static)
+  for (int k = 0; k < size; k++) {
+    double* yk = &y[(long)k * trials];
+    double* yak = &ya[(long)k * trials];
+    for (int t = 0; t < trials; t++) yk[t] = yak[t] = 0;
+    for (int j = 0; j < size; j++) {
+      double b = matB[k][j];
+      const double* rj = &r[(long)j * trials];
+      for (int t = 0; t < trials; t++) {
+        yk[t] += b * rj[t];
+        yak[t] += fabs(b) * fabs(rj[t]);
+      }
+    }
+  }
+
+  double tolerance = TOLERANCE * sqrt((double)size) * DBL_EPSILON;
+  Verification v = {true, 0, -1, 0};
+  #pragma omp parallel
+  {
+    vector<double> z(trials), za(trials), w(trials);
+    long bad = 0;
+    int firstBad = -1;
+    double worst = 0;
+
+    #pragma omp for schedule(static) nowait
+    for (int i = 0; i < size; i++) {
+      for (int t = 0; t < trials; t++) z[t] = za[t] = w[t] = 0;
+      for (int k = 0; k < size; k++) {
+        double a = matA[i][k], c = matC[i][k];
+        const double* yk = &y[(long)k * trials];
+        const double* yak = &ya[(long)k * trials];
+        const double* rk = &r[(long)k * trials];
+        for (int t = 0; t < trials; t++) {
+          z[t] += a * yk[t];
+          za[t] += fabs(a) * yak[t];
+          w[t] += c * rk[t];
+        }
+      }
+      for (int t = 0; t < trials; t++) {
+        double bound = tolerance * za[t] + DBL_MIN;
+        double ratio = fabs(w[t] - z[t]) / bound;
+        if (!(ratio <= 1)) {        //also catches NaN
+          bad++;
+          if (firstBad < 0) firstBad = i;
+        }
+        if (ratio > worst || ratio != ratio) worst = ratio;
+      }
+    }
+
+    #pragma omp critical
+    {
+      v.badEntries += bad;
+      if (firstBad >= 0 && (v.firstBadRow < 0 || firstBad < v.firstBadRow)) v.firstBadRow = firstBad;
+      if (worst > v.worst || worst != worst) v.worst = worst;
+    }
+  }
+  v.ok = v.badEntries == 0;
+  return v;
+}
+
+void report(const char* what, const Verification& v, double ms){
+  cout<<what<<(v.ok ? "passed" : "FAILED");
+  if (ms >= 0) cout<<" in "<<ms<<"ms";
+  if (!v.ok) cout<<" ("<<v.badEntries<<" bad entries, first in row "<<v.firstBadRow<<")";
+  cout<<", worst error "<<v.worst<<" of the bound"<<endl;
+}
+
+/*
+ * A method that runs a kernel, verifies its result, compares that with the cost of the naive
+ * recomputation, and checks that corrupted results are caught.
+ */
+void matVerify(int size, bool avx, int trials){
+  double** matA = initMat(size);
+  double** matB = initMat(size);
+  double** matC = initMat(size);
+  populateMat(matA, size);
+  populateMat(matB, size);
+  std::random_device rd;
+
+  high_resolution_clock::time_point start = high_resolution_clock::now();//Start clock
+  if (avx) mat_multiply_avx(matA, matB, matC, size);
+  else mat_multiply_compiler_intrinsics(matA, matB, matC, size);
+  double kernelMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  cout<<(avx ? "mat_multiply_avx: " : "mat_multiply_compiler_intrinsics: ")<<kernelMs<<"ms"<<endl;
+
+  start = high_resolution_clock::now();
+  Verification v = freivalds(matA, matB, matC, size, trials, rd());
+  double verifyMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+  report("Freivalds, ", v, verifyMs);
+  cout<<"  "<<trials<<" trials, overhead "<<100 * verifyMs / kernelMs<<"% of the kernel"<<endl;
+
+  if (size <= 1500) {
+    double** ref = initMat(size);
+    start = high_resolution_clock::now();
+    multiply(matA, matB, ref, size);
+    double naiveMs = (double)duration_cast<nanoseconds>( high_resolution_clock::now() - start ).count()/1000000;
+    double maxDiff = 0;
+    for (int i = 0; i < size; i++)
+      for (int j = 0; j < size; j++) maxDiff = max(maxDiff, fabs(ref[i][j] - matC[i][j]) / ref[i][j]);
+    cout<<"naive recomputation: "<<naiveMs<<"ms, max relative difference = "<<maxDiff<<endl;
+    freeMat(ref, size);
+  }
+
+  //corrupt C: one entry by one part in 10^9, then one bit flip high in the exponent
+  std::mt19937 gen(rd());
+  int i = gen() % size, j = gen() % size;
+  double saved = matC[i][j];
+  matC[i][j] *= 1 + 1e-9;
+  report("C off by 1e-9 relative at one entry:   ", freivalds(matA, matB, matC, size, trials, rd()), -1);
+  matC[i][j] = saved;
+
+  uint64_t bits;
+  memcpy(&bits, &matC[i][j], sizeof(bits));
+  bits ^= 1ULL << 61;
+  memcpy(&matC[i][j], &bits, sizeof(bits));
+  report("C with one flipped exponent bit:       ", freivalds(matA, matB, matC, size, trials, rd()), -1);
+
+  freeMat(matA, size);
+  freeMat(matB, size);
+  freeMat(matC, size);
+}
+
+int main(int argc, const char* argv[]) {
+
+  if (argc < 2) {
+    cout<<"usage: "<<argv[0]<<" <matrix_size> [avx|sse] [trials]"<<endl;
+    return 1;
+  }
+  int size = atoi(argv[1]);
+  bool avx = argc < 3 || string(argv[2]) != "sse";
+  int trials = argc > 3 ? atoi(argv[3]) : 2;
+  if (size < 1 || trials < 1) {
+    cout<<"the matrix size and number of trials must be positive"<<endl;
+    return 1;
+  }
+  matVerify(size, avx, trials);
+  return 0;
+}